@@ -19,7 +19,9 @@ class MainComponent  : public Component, private MidiInputCallback, private Time
         Channel,
         ToggleBehaviour,
         LFODest,
-        Dump
+        Dump,
+        Stats,
+        Mpe
     };
     
     // LFO Destination happens to be the last parameter, which is very lucky
@@ -49,7 +51,7 @@ public:
         startTimer(initialised ? 700 : 100);
         
         // Resize window
-        setSize (420, 270);
+        setSize (420, 300);
         
         // Add options for toggle combo
         shift_param_mode.addItem("PICKUP MODE", 1);
@@ -60,6 +62,12 @@ public:
             channel_select.addItem(String(i), i);
         }
         
+        // Member channels of the MPE zone, after the MIDI channel
+        mpe_select.addItem("OFF", 1);
+        for(int i = 1; i < 16; i++) {
+            mpe_select.addItem(String(i) + " CHANNELS", i + 1);
+        }
+        
         channel_select.onChange = [this](){
             // Send channel change message
             send_message(Channel, {channel_select.getSelectedId()});
@@ -70,6 +78,10 @@ public:
             send_message(ToggleBehaviour, {shift_param_mode.getSelectedId() - 1});
         };
         
+        mpe_select.onChange = [this](){
+            send_message(Mpe, {mpe_select.getSelectedId() - 1});
+        };
+        
 
         // Add child components
         addAndMakeVisible(channel_select);
@@ -92,9 +104,12 @@ public:
         lfo_dest_2.setSelectedId(27);
         lfo_dest_3.setSelectedId(30);
         
+        mpe_select.setSelectedId(1);
+        
         addAndMakeVisible(lfo_dest_1);
         addAndMakeVisible(lfo_dest_2);
         addAndMakeVisible(lfo_dest_3);
+        addAndMakeVisible(mpe_select);
         
         lfo_dest_1.onChange = [this](){
             // Send channel change message
@@ -210,6 +225,7 @@ public:
         g.drawText("LFO DESTINATION 1", lfo_dest_1.getBounds().translated(-190, 0), Justification::left);
         g.drawText("LFO DESTINATION 2", lfo_dest_2.getBounds().translated(-190, 0), Justification::left);
         g.drawText("LFO DESTINATION 3", lfo_dest_3.getBounds().translated(-190, 0), Justification::left);
+        g.drawText("MPE", mpe_select.getBounds().translated(-190, 0), Justification::left);
         
         int logoWidth = logo.getBounds().proportionOfWidth(0.1f);
         int logoHeight = logo.getBounds().proportionOfHeight(0.1f);
@@ -226,6 +242,8 @@ public:
         lfo_dest_1.setBounds(200, 110, 200, 20);
         lfo_dest_2.setBounds(200, 140, 200, 20);
         lfo_dest_3.setBounds(200, 170, 200, 20);
+        
+        mpe_select.setBounds(200, 200, 200, 20);
     }
     
 private:
@@ -295,6 +313,7 @@ private:
                 int dest_1 = data[5];
                 int dest_2 = data[6];
                 int dest_3 = data[7];
+                int mpe_channels = data[8];
                 
                 channel_select.setSelectedId(channel);
                 shift_param_mode.setSelectedId(toggle + 1);
@@ -302,6 +321,8 @@ private:
                 lfo_dest_1.setSelectedId(dest_1);
                 lfo_dest_2.setSelectedId(dest_2);
                 lfo_dest_3.setSelectedId(dest_3);
+                
+                mpe_select.setSelectedId(mpe_channels + 1);
             }
         }
     }
@@ -317,6 +338,8 @@ private:
     ComboBox lfo_dest_2;
     ComboBox lfo_dest_3;
     
+    ComboBox mpe_select;
+    
     // Variable indiating connection status with Recipher
     bool initialised = false;
     
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "FileUtil.h"
+
+// Parameter automation for the offline renderer. Every line sets a knob or switch at a point in time:
+//
+//   # seconds  control  value
+//   0.0        MIX      0.8
+//   1.5        SHIFT    1
+//   1.6        DELAY    0.25
+//
+// Knob values are positions from 0 to 1, as read from the ADC. A knob is named after either of its
+// parameters (or KNOB1 to KNOB10), so like on the hardware, a second page parameter only follows its
+// knob while SHIFT is on. SHIFT and FREEZE take 0 or 1.
+
+enum class AutomationTarget
+{
+    Knob,
+    Shift,
+    Freeze
+};
+
+struct AutomationEvent
+{
+    double time;
+    AutomationTarget target;
+    int knob;
+    float value;
+};
+
+static const std::pair<const char*, ParameterPin> parameter_names[] = {
+    {"MIX", MIX},         {"LPF_Q", LPF_Q},       {"LPF_NOTE", LPF_NOTE},       {"SHAPE", SHAPE},
+    {"Q", Q},             {"OCTAVER", OCTAVER},   {"ATTACK", ATTACK},           {"DECAY", DECAY},
+    {"SUSTAIN", SUSTAIN}, {"RELEASE", RELEASE},   {"GAIN", GAIN},               {"FEEDBACK", FEEDBACK},
+    {"DELAY", DELAY},     {"STRETCH", STRETCH},   {"DRIVE", DRIVE},             {"FREEZE_SIZE", FREEZE_SIZE},
+    {"LFO_SHAPE", LFO_SHAPE}, {"LFO_RATE", LFO_RATE}, {"LFO_DEPTH", LFO_DEPTH}, {"LFO_DEST", LFO_DEST},
+};
+
+// Returns the knob index for a parameter or knob name, or -1
+static int find_knob(const std::string& name)
+{
+    for(auto& [parameter_name, pin] : parameter_names) {
+        if(name == parameter_name) return pin >= GAIN ? pin - GAIN : pin - MIX;
+    }
+
+    int knob;
+    char end;
+    if(sscanf(name.c_str(), "KNOB%d%c", &knob, &end) == 1 && knob >= 1 && knob <= 10) return knob - 1;
+
+    return -1;
+}
+
+bool read_automation(const std::string& path, std::vector<AutomationEvent>& events, std::string& error)
+{
+    std::vector<uint8_t> data;
+    if(!read_file(path, data)) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    std::string text(data.begin(), data.end());
+
+    size_t line_start = 0;
+    int line_number = 0;
+
+    while(line_start < text.size()) {
+        size_t line_end = text.find('\n', line_start);
+        if(line_end == std::string::npos) line_end = text.size();
+
+        std::string line = text.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+        line_number++;
+
+        line = line.substr(0, line.find('#'));
+
+        // Skip empty and comment lines
+        if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        char name[64];
+        double time;
+        float value;
+
+        AutomationEvent event = {0.0, AutomationTarget::Knob, -1, 0.0f};
+
+        bool valid = sscanf(line.c_str(), "%lf %63s %f", &time, name, &value) == 3 && time >= 0.0;
+
+        if(valid) {
+            event.time = time;
+            event.value = value;
+
+            if(!strcmp(name, "SHIFT")) {
+                event.target = AutomationTarget::Shift;
+            }
+            else if(!strcmp(name, "FREEZE")) {
+                event.target = AutomationTarget::Freeze;
+            }
+            else {
+                event.knob = find_knob(name);
+                valid = event.knob >= 0;
+            }
+        }
+
+        if(!valid) {
+            error = path + ":" + std::to_string(line_number) + ": expected <seconds> <control> <value>";
+            return false;
+        }
+
+        events.push_back(event);
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const AutomationEvent& a, const AutomationEvent& b) { return a.time < b.time; });
+
+    return true;
+}
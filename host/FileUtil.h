@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Reads a whole file into memory
+static bool read_file(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file) return false;
+
+    uint8_t buffer[4096];
+    size_t num_read;
+    while((num_read = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + num_read);
+    fclose(file);
+
+    return true;
+}
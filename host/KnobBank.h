@@ -0,0 +1,22 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+constexpr int num_knobs = 10;
+
+// Stands in for the ADC buffer that the knobs are read from on the Seed
+struct KnobBank
+{
+    KnobBank() {
+        for(int i = 0; i < num_knobs; i++) set(i, 0.5f);
+    }
+
+    uint16_t* GetPtr(uint8_t chn) { return &values[chn]; }
+
+    void set(int knob, float position) {
+        values[knob] = static_cast<uint16_t>(std::clamp(position, 0.0f, 1.0f) * 65535.0f);
+    }
+
+    uint16_t values[num_knobs];
+};
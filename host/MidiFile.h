@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FileUtil.h"
+
+// Standard MIDI file reader for the offline renderer. Channel messages from all tracks are merged
+// and converted to daisy::MidiEvent the same way MidiHandler::Parse would deliver them.
+
+struct TimedMidiEvent
+{
+    double time; // In seconds
+    daisy::MidiEvent event;
+};
+
+struct MidiFileReader
+{
+    MidiFileReader(const std::vector<uint8_t>& file_data) : data(file_data) {}
+
+    bool read(std::vector<TimedMidiEvent>& events, std::string& error)
+    {
+        if(!read_tag("MThd") || read_int(4) != 6) {
+            error = "not a standard MIDI file";
+            return false;
+        }
+
+        read_int(2); // format, all types are merged into one stream
+        int num_tracks = read_int(2);
+        int division = read_int(2);
+
+        for(int track = 0; track < num_tracks && ok(); track++) {
+            if(!read_tag("MTrk")) {
+                error = "missing track chunk";
+                return false;
+            }
+
+            size_t end = std::min(data.size(), pos + read_int(4));
+            read_track(end);
+            pos = end;
+        }
+
+        if(!ok()) {
+            error = "truncated MIDI file";
+            return false;
+        }
+
+        // Sort by tick, keeping the file order for events on the same tick
+        std::stable_sort(messages.begin(), messages.end(), [](const Message& a, const Message& b) { return a.tick < b.tick; });
+
+        // Convert ticks to seconds, following the tempo map
+        double seconds_per_tick;
+        if(division & 0x8000) {
+            int frames_per_second = 256 - (division >> 8);
+            seconds_per_tick = 1.0 / (frames_per_second * (division & 0xFF));
+        }
+        else {
+            seconds_per_tick = 0.5 / division; // 120 bpm until the first tempo event
+        }
+
+        uint64_t last_tick = 0;
+        double time = 0.0;
+
+        for(auto& message : messages) {
+            time += (message.tick - last_tick) * seconds_per_tick;
+            last_tick = message.tick;
+
+            if(message.tempo) {
+                if(!(division & 0x8000)) seconds_per_tick = message.tempo / (1000000.0 * division);
+                continue;
+            }
+
+            events.push_back({time, message.event});
+        }
+
+        return true;
+    }
+
+private:
+    struct Message
+    {
+        uint64_t tick;
+        uint32_t tempo; // Microseconds per quarter note for tempo meta events, 0 otherwise
+        daisy::MidiEvent event;
+    };
+
+    bool ok() const { return !truncated; }
+
+    uint8_t read_byte()
+    {
+        if(pos >= data.size()) {
+            truncated = true;
+            return 0;
+        }
+        return data[pos++];
+    }
+
+    uint32_t read_int(int num_bytes)
+    {
+        uint32_t value = 0;
+        for(int i = 0; i < num_bytes; i++) value = (value << 8) | read_byte();
+        return value;
+    }
+
+    uint32_t read_variable_length()
+    {
+        uint32_t value = 0;
+        uint8_t byte;
+        do {
+            byte = read_byte();
+            value = (value << 7) | (byte & 0x7F);
+        } while((byte & 0x80) && ok());
+        return value;
+    }
+
+    bool read_tag(const char* tag)
+    {
+        bool matches = true;
+        for(int i = 0; i < 4; i++) matches &= read_byte() == static_cast<uint8_t>(tag[i]);
+        return matches && ok();
+    }
+
+    void read_track(size_t end)
+    {
+        uint64_t tick = 0;
+        uint8_t running_status = 0;
+
+        while(pos < end && ok()) {
+            tick += read_variable_length();
+
+            uint8_t status = (pos < data.size() && (data[pos] & 0x80)) ? read_byte() : running_status;
+
+            if(status == 0xFF) {
+                uint8_t type = read_byte();
+                uint32_t length = read_variable_length();
+
+                if(type == 0x51 && length == 3) {
+                    Message message = {};
+                    message.tick = tick;
+                    message.tempo = read_int(3);
+                    messages.push_back(message);
+                }
+                else {
+                    pos += length;
+                }
+
+                if(type == 0x2F) break; // End of track
+                continue;
+            }
+
+            // SysEx is skipped, settings messages are not part of the signal chain
+            if(status == 0xF0 || status == 0xF7) {
+                pos += read_variable_length();
+                continue;
+            }
+
+            if(!(status & 0x80) || status > 0xEF) {
+                // Data byte without running status or a stray system message, the track is corrupt from here on
+                break;
+            }
+
+            running_status = status;
+
+            daisy::MidiEvent event = {};
+            event.type = static_cast<daisy::MidiMessageType>((status & 0x70) >> 4);
+            event.channel = status & 0x0F;
+
+            event.data[0] = read_byte() & 0x7F;
+
+            bool single_data_byte = event.type == daisy::ProgramChange || event.type == daisy::ChannelPressure;
+            if(!single_data_byte) event.data[1] = read_byte() & 0x7F;
+
+            // velocity 0 NoteOns are NoteOffs
+            if(event.type == daisy::NoteOn && event.data[1] == 0) event.type = daisy::NoteOff;
+
+            if(event.type == daisy::ControlChange && event.data[0] > 119) {
+                event.type = daisy::ChannelMode;
+                event.cm_type = static_cast<daisy::ChannelModeType>(event.data[0] - 120);
+            }
+
+            Message message = {};
+            message.tick = tick;
+            message.event = event;
+            messages.push_back(message);
+        }
+    }
+
+    const std::vector<uint8_t>& data;
+    size_t pos = 0;
+    bool truncated = false;
+
+    std::vector<Message> messages;
+};
+
+bool read_midi_file(const std::string& path, std::vector<TimedMidiEvent>& events, std::string& error)
+{
+    std::vector<uint8_t> data;
+    if(!read_file(path, data)) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    if(!MidiFileReader(data).read(events, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "FileUtil.h"
+
+// Minimal RIFF/WAVE reader and writer for the offline renderer
+
+struct WavData
+{
+    std::vector<float> samples; // First channel only, the Recipher has a mono input
+    int sample_rate = 0;
+    int channels = 0;
+};
+
+static uint32_t read_le(const uint8_t* data, int num_bytes)
+{
+    uint32_t value = 0;
+    for(int i = 0; i < num_bytes; i++) value |= static_cast<uint32_t>(data[i]) << (8 * i);
+    return value;
+}
+
+static void write_le(std::vector<uint8_t>& out, uint32_t value, int num_bytes)
+{
+    for(int i = 0; i < num_bytes; i++) out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+// Reads 16, 24 or 32 bit integer PCM or 32 bit float files
+bool read_wav(const std::string& path, WavData& wav, std::string& error)
+{
+    std::vector<uint8_t> data;
+    if(!read_file(path, data)) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    if(data.size() < 12 || memcmp(data.data(), "RIFF", 4) || memcmp(data.data() + 8, "WAVE", 4)) {
+        error = path + " is not a WAVE file";
+        return false;
+    }
+
+    int format = 0;
+    int bits = 0;
+    const uint8_t* pcm = nullptr;
+    size_t pcm_size = 0;
+
+    size_t pos = 12;
+    while(pos + 8 <= data.size()) {
+        const uint8_t* chunk = data.data() + pos;
+        size_t chunk_size = read_le(chunk + 4, 4);
+        size_t available = std::min(chunk_size, data.size() - pos - 8);
+
+        if(!memcmp(chunk, "fmt ", 4) && available >= 16) {
+            format = read_le(chunk + 8, 2);
+            wav.channels = read_le(chunk + 10, 2);
+            wav.sample_rate = read_le(chunk + 12, 4);
+            bits = read_le(chunk + 22, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE stores the real format in the sub format GUID
+            if(format == 0xFFFE && available >= 26) format = read_le(chunk + 32, 2);
+        }
+        else if(!memcmp(chunk, "data", 4)) {
+            pcm = chunk + 8;
+            pcm_size = available;
+        }
+
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    bool is_pcm = format == 1 && (bits == 16 || bits == 24 || bits == 32);
+    bool is_float = format == 3 && bits == 32;
+
+    if(!pcm || wav.channels < 1 || (!is_pcm && !is_float)) {
+        error = path + " has an unsupported sample format";
+        return false;
+    }
+
+    int frame_size = wav.channels * bits / 8;
+    size_t num_frames = pcm_size / frame_size;
+
+    wav.samples.resize(num_frames);
+
+    for(size_t i = 0; i < num_frames; i++) {
+        const uint8_t* sample = pcm + i * frame_size;
+
+        if(is_float) {
+            uint32_t raw = read_le(sample, 4);
+            memcpy(&wav.samples[i], &raw, sizeof(float));
+        }
+        else {
+            // Shift into the top of an int32 to sign extend
+            int32_t value = static_cast<int32_t>(read_le(sample, bits / 8) << (32 - bits));
+            wav.samples[i] = value / 2147483648.0f;
+        }
+    }
+
+    return true;
+}
+
+// Writes a mono 32 bit float file
+bool write_wav(const std::string& path, const std::vector<float>& samples, int sample_rate, std::string& error)
+{
+    uint32_t data_size = samples.size() * sizeof(float);
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), {'R', 'I', 'F', 'F'});
+    write_le(header, 36 + data_size, 4);
+    header.insert(header.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    write_le(header, 16, 4);
+    write_le(header, 3, 2); // IEEE float
+    write_le(header, 1, 2);
+    write_le(header, sample_rate, 4);
+    write_le(header, sample_rate * sizeof(float), 4);
+    write_le(header, sizeof(float), 2);
+    write_le(header, 32, 2);
+    header.insert(header.end(), {'d', 'a', 't', 'a'});
+    write_le(header, data_size, 4);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file) {
+        error = "can't write " + path;
+        return false;
+    }
+
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+    ok = ok && fwrite(samples.data(), sizeof(float), samples.size(), file) == samples.size();
+    fclose(file);
+
+    if(!ok) error = "failed writing " + path;
+
+    return ok;
+}
@@ -0,0 +1,756 @@
+// Benchmarks and statistical checks for the building blocks of the signal chain, run off-device.
+// Each benchmark prints its timings and checks, the exit code is non-zero if any check failed.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// hid/midi.h normally defines this before including MidiEvent.h
+#define SYSEX_BUFFER_LEN 128
+
+#include "hid/MidiEvent.h"
+#include "hid/ctrl.h"
+#include "hid/parameter.h"
+
+#include "daisysp.h"
+
+using namespace daisysp;
+using namespace daisy;
+
+#include "Engine.h"
+
+#include "KnobBank.h"
+
+constexpr size_t bench_block_size = max_block_size;
+
+// Keeps the optimiser from dropping benchmark loops whose output is never read
+static volatile float sink;
+
+// Runs process on a block repeatedly and returns the time per sample in nanoseconds
+template <typename Process>
+static double time_per_sample(Process&& process, size_t blocks = 20000)
+{
+    float buffer[bench_block_size];
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(size_t block = 0; block < blocks; block++) {
+        process(buffer, bench_block_size);
+        sink = buffer[block % bench_block_size];
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / (blocks * bench_block_size);
+}
+
+static bool check(const char* name, double value, double min, double max)
+{
+    bool passed = value >= min && value <= max;
+    printf("  %-28s %12.5f   [%g, %g]  %s\n", name, value, min, max, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+// Average power of signal at frequency, over segments of segment_size samples (Goertzel)
+static double power_at(const std::vector<float>& signal, double frequency, size_t segment_size)
+{
+    double coefficient = 2.0 * cos(2.0 * M_PI * frequency / sample_rate);
+    double total = 0.0;
+    size_t segments = signal.size() / segment_size;
+
+    for(size_t segment = 0; segment < segments; segment++) {
+        double s1 = 0.0, s2 = 0.0;
+
+        for(size_t i = 0; i < segment_size; i++) {
+            double s0 = signal[segment * segment_size + i] + coefficient * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+
+        total += s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+    }
+
+    return total / segments;
+}
+
+// Spectral slope in dB per octave, fitted over octaves from 125 Hz to 8 kHz
+static double octave_slope(const std::vector<float>& signal)
+{
+    double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    int count = 0;
+
+    for(double frequency = 125.0; frequency <= 8000.0; frequency *= 2.0) {
+        double x = log2(frequency);
+        double y = 10.0 * log10(power_at(signal, frequency, 1024));
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        count++;
+    }
+
+    return (count * sum_xy - sum_x * sum_y) / (count * sum_xx - sum_x * sum_x);
+}
+
+static bool bench_noise()
+{
+    printf("noise\n");
+
+    auto generator = std::default_random_engine();
+    auto distribution = std::uniform_real_distribution<float>(-0.999, +0.999);
+
+    double std_time = time_per_sample([&](float* out, size_t size) {
+        for(size_t i = 0; i < size; i++) out[i] = distribution(generator);
+    });
+
+    NoiseGenerator noise;
+    noise.init();
+
+    double white_time = time_per_sample([&](float* out, size_t size) { noise.process_block(out, size); });
+    double pink_time = time_per_sample([&](float* out, size_t size) { noise.process_block_pink(out, size); });
+
+    printf("  %-28s %9.2f ns/sample\n", "std::default_random_engine", std_time);
+    printf("  %-28s %9.2f ns/sample (%.1fx)\n", "NoiseGenerator white", white_time, std_time / white_time);
+    printf("  %-28s %9.2f ns/sample (%.1fx)\n", "NoiseGenerator pink", pink_time, std_time / pink_time);
+
+    constexpr size_t num_samples = 1 << 20;
+    std::vector<float> white(num_samples), pink(num_samples);
+
+    noise.init();
+    for(size_t i = 0; i < num_samples; i += bench_block_size) noise.process_block(white.data() + i, bench_block_size);
+    for(size_t i = 0; i < num_samples; i += bench_block_size) noise.process_block_pink(pink.data() + i, bench_block_size);
+
+    double sum = 0.0, sum_squares = 0.0, lag_product = 0.0;
+    float low = white[0], high = white[0];
+    constexpr int num_bins = 16;
+    size_t histogram[num_bins] = {};
+
+    for(size_t i = 0; i < num_samples; i++) {
+        float x = white[i];
+        sum += x;
+        sum_squares += x * x;
+        if(i > 0) lag_product += x * white[i - 1];
+        low = std::min(low, x);
+        high = std::max(high, x);
+        histogram[std::min(static_cast<int>((x + 1.0f) * 0.5f * num_bins), num_bins - 1)]++;
+    }
+
+    double mean = sum / num_samples;
+    double variance = sum_squares / num_samples - mean * mean;
+
+    // Chi-squared against a flat histogram, 15 degrees of freedom: 30.6 is the 1% critical value
+    double expected = static_cast<double>(num_samples) / num_bins;
+    double chi_squared = 0.0;
+    for(size_t count : histogram) chi_squared += (count - expected) * (count - expected) / expected;
+
+    double pink_squares = 0.0;
+    for(float x : pink) pink_squares += x * x;
+
+    bool passed = true;
+    passed &= check("white minimum", low, -1.0, -0.999);
+    passed &= check("white maximum", high, 0.999, 1.0);
+    passed &= check("white mean", mean, -0.005, 0.005);
+    passed &= check("white variance (1/3)", variance, 0.33, 0.337);
+    passed &= check("white lag-1 correlation", lag_product / sum_squares, -0.005, 0.005);
+    passed &= check("white histogram chi-squared", chi_squared, 0.0, 30.6);
+    passed &= check("white slope (dB/octave)", octave_slope(white), -0.5, 0.5);
+    passed &= check("pink / white RMS", sqrt(pink_squares / sum_squares), 0.9, 1.1);
+    passed &= check("pink slope (dB/octave)", octave_slope(pink), -3.5, -2.5);
+
+    return passed;
+}
+
+// Runs a voice's resonator on noise with its octave band off, down and up, and checks where the energy lands
+static bool bench_octave_band()
+{
+    printf("octave band\n");
+
+    using Filter = ShapeFilter<num_voice_harmonics, num_voice_cascades>;
+
+    constexpr size_t num_samples = 1 << 17;
+    constexpr float note = 57.0f; // 220 Hz
+
+    std::vector<float> input(num_samples);
+    NoiseGenerator noise;
+    noise.init();
+    for(size_t i = 0; i < num_samples; i += bench_block_size) noise.process_block(input.data() + i, bench_block_size);
+
+    // The octave band uses a padding lane when there is one, then it costs nothing extra
+    printf("  %d harmonics + octave band in %d lanes\n", num_voice_harmonics, Filter::num_lanes);
+
+    bool passed = true;
+
+    // Octave levels relative to the fundamental with the band off. The fundamental's band and the analysis
+    // both leak into the octaves, so these are only 20 to 30 dB down.
+    double below_off = 0.0, above_off = 0.0;
+
+    for(float level : {0.0f, -1.0f, 1.0f}) {
+        Filter filter;
+        filter.set_shape(0.0f); // Sine, only the fundamental
+        filter.set_pitch(note);
+        filter.set_octave(level);
+        filter.update_filter();
+
+        size_t position = 0;
+        double time = time_per_sample([&](float* out, size_t size) {
+            filter.process_block(input.data() + position, out, size);
+            position = (position + size) % num_samples;
+        });
+
+        filter.clear_filters();
+        std::vector<float> output(num_samples);
+        for(size_t i = 0; i < num_samples; i += bench_block_size) filter.process_block(input.data() + i, output.data() + i, bench_block_size);
+
+        double fundamental = power_at(output, mtof(note), 1024);
+        double below = 10.0 * log10(power_at(output, mtof(note - 12.0f), 1024) / fundamental);
+        double above = 10.0 * log10(power_at(output, mtof(note + 12.0f), 1024) / fundamental);
+
+        printf("  level %+.0f: %6.2f ns/sample, octave down %6.2f dB, octave up %6.2f dB\n", level, time, below, above);
+
+        if(level == 0.0f) {
+            below_off = below;
+            above_off = above;
+            continue;
+        }
+
+        // The band that is on comes up to about the level of the fundamental, the other one stays as it was
+        double on = level < 0.0f ? below : above;
+        double other = level < 0.0f ? above - above_off : below - below_off;
+
+        char name[64];
+        snprintf(name, sizeof(name), "level %+.0f, octave dB", level);
+        passed &= check(name, on, -6.0, 3.0);
+
+        snprintf(name, sizeof(name), "level %+.0f, rise over off dB", level);
+        passed &= check(name, on - (level < 0.0f ? below_off : above_off), 15.0, 1000.0);
+
+        snprintf(name, sizeof(name), "level %+.0f, other octave dB", level);
+        passed &= check(name, other, -3.0, 3.0);
+    }
+
+    return passed;
+}
+
+// The per-sample ShapeFilter::process is the scalar reference for process_block. Both run the same settings
+// and coefficient changes, with ramping off so both switch coefficients at the same sample.
+static bool bench_scalar_reference()
+{
+    printf("scalar reference\n");
+
+    using Filter = ShapeFilter<num_voice_harmonics, num_voice_cascades>;
+
+    constexpr size_t num_blocks = 64;
+    constexpr size_t num_samples = num_blocks * bench_block_size;
+
+    std::vector<float> input(num_samples);
+    NoiseGenerator noise;
+    noise.init();
+    for(size_t i = 0; i < num_samples; i += bench_block_size) noise.process_block(input.data() + i, bench_block_size);
+
+    Filter scalar, block;
+    std::vector<float> scalar_output(num_samples), block_output(num_samples);
+
+    for(Filter* filter : {&scalar, &block}) {
+        filter->set_coefficient_ramping(false);
+        filter->set_shape(2.0f); // Square, every other harmonic
+        filter->set_octave(-0.5f);
+    }
+
+    for(size_t b = 0; b < num_blocks; b++) {
+        // Move pitch, Q and stretch every few blocks
+        if(b % 8 == 0) {
+            for(Filter* filter : {&scalar, &block}) {
+                filter->set_pitch(40.0f + 3.0f * b / 8);
+                filter->set_q(2.0f + b * 0.25f);
+                filter->set_stretch(0.5f + b * 0.01f);
+                filter->update_filter();
+            }
+        }
+
+        size_t offset = b * bench_block_size;
+        for(size_t i = 0; i < bench_block_size; i++) scalar_output[offset + i] = scalar.process(input[offset + i]);
+        scalar.reset_unstable_bands();
+
+        block.process_block(input.data() + offset, block_output.data() + offset, bench_block_size);
+    }
+
+    double peak = 0.0, max_error = 0.0;
+    for(size_t i = 0; i < num_samples; i++) {
+        peak = std::max(peak, static_cast<double>(std::abs(scalar_output[i])));
+        max_error = std::max(max_error, static_cast<double>(std::abs(scalar_output[i] - block_output[i])));
+    }
+
+    double time_scalar = time_per_sample([&](float* out, size_t size) {
+        for(size_t i = 0; i < size; i++) out[i] = scalar.process(input[i]);
+    });
+    double time_block = time_per_sample([&](float* out, size_t size) {
+        block.process_block(input.data(), out, size);
+    });
+
+    printf("  scalar %.2f ns/sample, block %.2f ns/sample\n", time_scalar, time_block);
+
+    bool passed = true;
+    passed &= check("output peak", peak, 0.01, 1000.0);
+    passed &= check("max difference / peak", max_error / peak, 0.0, 1e-5);
+
+    return passed;
+}
+
+// DelayLinePow2's block reads against DaisySP's DelayLine, sample by sample. The line is short, so the write
+// pointer wraps many times, and the delays go from the shortest a block read allows to the longest the line holds.
+static bool bench_delay_line()
+{
+    printf("delay line\n");
+
+    constexpr size_t line_size = 1024;
+    static DelayLine<float, line_size> reference;
+    static DelayLinePow2<float, line_size> line;
+    reference.Init();
+    line.Init();
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> sample_dist(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> delay_dist(bench_block_size + 1.0f, line_size - 3.0f);
+
+    float samples[bench_block_size], delays[bench_block_size], block[bench_block_size];
+    double max_difference = 0.0;
+
+    for(int b = 0; b < 200; b++) {
+        for(size_t i = 0; i < bench_block_size; i++) {
+            samples[i] = sample_dist(rng);
+            delays[i] = delay_dist(rng);
+        }
+
+        // Both ends of the range in every block
+        delays[0] = bench_block_size + 1.0f;
+        delays[1] = line_size - 3.0f;
+
+        line.ReadHermiteBlock(delays, block, bench_block_size);
+        line.WriteBlock(samples, bench_block_size);
+
+        for(size_t i = 0; i < bench_block_size; i++) {
+            float expected = reference.ReadHermite(delays[i]);
+            reference.Write(samples[i]);
+            max_difference = std::max(max_difference, static_cast<double>(std::abs(block[i] - expected)));
+        }
+    }
+
+    return check("max difference", max_difference, 0.0, 0.0);
+}
+
+// Aliasing of the drive on a 3 kHz sine: the power that odd harmonics above nyquist fold back onto inharmonic
+// frequencies, relative to the fundamental. At 32 kHz every alias lands on an odd multiple of 1 kHz, which
+// the 1024 sample analysis segments resolve exactly.
+static double drive_aliasing_db(Drive<bench_block_size>& drive)
+{
+    constexpr double frequency = 3000.0;
+    constexpr size_t num_samples = 1 << 16;
+
+    std::vector<float> signal(num_samples);
+    for(size_t i = 0; i < num_samples; i++) signal[i] = 0.5f * sinf(2.0f * static_cast<float>(M_PI * frequency / sample_rate) * i);
+    for(size_t i = 0; i < num_samples; i += bench_block_size) drive.process_block(signal.data() + i, bench_block_size);
+
+    // Skip the level matching settling in
+    signal.erase(signal.begin(), signal.begin() + num_samples / 4);
+
+    std::vector<double> aliases;
+    for(int harmonic = 7; harmonic < 32; harmonic += 2) {
+        double alias = fmod(harmonic * frequency, sample_rate);
+        if(alias > sample_rate / 2) alias = sample_rate - alias;
+
+        bool harmonic_below_nyquist = harmonic * frequency < sample_rate / 2;
+        bool counted = std::find(aliases.begin(), aliases.end(), alias) != aliases.end();
+        bool on_harmonic = fmod(alias, 2.0 * frequency) == frequency;
+        if(!harmonic_below_nyquist && !counted && !on_harmonic) aliases.push_back(alias);
+    }
+
+    double alias_power = 0.0;
+    for(double alias : aliases) alias_power += power_at(signal, alias, 1024);
+
+    return 10.0 * log10(alias_power / power_at(signal, frequency, 1024));
+}
+
+static bool bench_drive()
+{
+    printf("drive\n");
+
+    std::vector<float> input(bench_block_size);
+    NoiseGenerator noise;
+    noise.init();
+    noise.process_block(input.data(), bench_block_size, 0.5f);
+
+    Overdrive overdrive;
+    Balance balance;
+    overdrive.Init();
+    overdrive.SetDrive(1.0f);
+    balance.Init(sample_rate);
+
+    double daisysp_time = time_per_sample([&](float* out, size_t size) {
+        for(size_t i = 0; i < size; i++) out[i] = balance.Process(overdrive.Process(input[i]), input[i]);
+    });
+
+    printf("  %-28s %9.2f ns/sample\n", "Overdrive + Balance", daisysp_time);
+
+    bool passed = true;
+
+    for(int oversampling : {1, 2, 4}) {
+        static Drive<bench_block_size> drive;
+        drive.init(sample_rate);
+        drive.set_oversampling(oversampling);
+        drive.set_drive(1.0f);
+
+        double time = time_per_sample([&](float* out, size_t size) {
+            memcpy(out, input.data(), size * sizeof(float));
+            drive.process_block(out, size);
+        });
+
+        printf("  Drive %dx %18s %9.2f ns/sample\n", oversampling, "", time);
+    }
+
+    // At moderate drive the clipper's harmonics die off quickly, and each doubling of the rate removes
+    // most of the aliasing. Fully driven it is close to a square wave, whose harmonics only fall 6 dB per
+    // octave, so there each doubling gains less.
+    for(float amount : {0.4f, 1.0f}) {
+        double aliasing[3];
+
+        for(int i = 0; i < 3; i++) {
+            static Drive<bench_block_size> drive;
+            drive.init(sample_rate);
+            drive.set_oversampling(1 << i);
+            drive.set_drive(amount);
+            aliasing[i] = drive_aliasing_db(drive);
+        }
+
+        printf("  drive %.1f aliasing: 1x %.2f dB, 2x %.2f dB, 4x %.2f dB\n", amount, aliasing[0], aliasing[1], aliasing[2]);
+
+        double gain = amount < 1.0f ? 15.0 : 5.0;
+        char name[64];
+        snprintf(name, sizeof(name), "drive %.1f, 2x below 1x (dB)", amount);
+        passed &= check(name, aliasing[0] - aliasing[1], gain, 1000.0);
+        snprintf(name, sizeof(name), "drive %.1f, 4x below 2x (dB)", amount);
+        passed &= check(name, aliasing[1] - aliasing[2], gain, 1000.0);
+    }
+
+    // The level matching keeps the driven signal at the level of the clean one. It measures the clipper's
+    // output before downsampling, so it counts the harmonics that the downsampler then removes, and fully
+    // driven noise comes out a little quieter.
+    static Drive<bench_block_size> drive;
+    drive.init(sample_rate);
+    drive.set_drive(1.0f);
+
+    double clean_squares = 0.0, driven_squares = 0.0;
+    std::vector<float> block(bench_block_size);
+
+    for(int i = 0; i < 200; i++) {
+        noise.process_block(block.data(), bench_block_size, 0.2f);
+        for(float x : block) clean_squares += i >= 100 ? x * x : 0.0;
+
+        drive.process_block(block.data(), bench_block_size);
+        for(float x : block) driven_squares += i >= 100 ? x * x : 0.0;
+    }
+
+    passed &= check("driven / clean RMS", sqrt(driven_squares / clean_squares), 0.8, 1.1);
+
+    return passed;
+}
+
+static MidiEvent make_note_event(MidiMessageType type, uint8_t note)
+{
+    MidiEvent event = {};
+    event.type = type;
+    event.channel = active_midi_channel - 1;
+    event.data[0] = note;
+    event.data[1] = 100;
+    return event;
+}
+
+// Plays notes at every position in the block through the full signal chain, and checks that each one
+// starts sounding the same number of samples after its timestamp
+static bool bench_onsets()
+{
+    printf("onsets\n");
+
+    KnobBank knobs;
+    knobs.set(0, 1.0f); // Audio input only, no noise
+    knobs.set(2, 1.0f); // Output filter open
+    knobs.set(6, 0.0f); // Shortest attack
+    knobs.set(9, 0.0f); // and release
+
+    SculptParameters::init(false, knobs);
+    init_engine();
+
+    // A 500 Hz input has a whole number of periods every 64 samples. Notes start 64 samples further
+    // into the block each time, so every note sees the same input, and should sound exactly the same.
+    constexpr size_t input_period = 64;
+    constexpr size_t note_spacing = 129 * input_period;
+    constexpr size_t note_length = 2048;
+    constexpr size_t first_note = 4096;
+    constexpr int num_notes = 12;
+    constexpr uint8_t note = 71;
+
+    size_t num_samples = first_note + num_notes * note_spacing;
+    num_samples += bench_block_size - num_samples % bench_block_size;
+
+    std::vector<float> input(num_samples), output(num_samples);
+    for(size_t i = 0; i < num_samples; i++) input[i] = 0.5f * sinf(2.0f * static_cast<float>(M_PI) * (i % input_period) / input_period);
+
+    std::vector<size_t> note_times;
+    for(int k = 0; k < num_notes; k++) note_times.push_back(first_note + k * note_spacing);
+
+    size_t next_note = 0;
+    bool note_held = false;
+
+    for(size_t offset = 0; offset < num_samples; offset += bench_block_size) {
+        // Queue the note ons and offs that fall in this block
+        while(next_note < note_times.size()) {
+            size_t time = note_times[next_note] + (note_held ? note_length : 0);
+            if(time >= offset + bench_block_size) break;
+
+            queue_midi_event(make_note_event(note_held ? NoteOff : NoteOn, note), static_cast<uint32_t>(time));
+
+            if(note_held) next_note++;
+            note_held = !note_held;
+        }
+
+        apply_lfo(bench_block_size);
+        update_parameters();
+        process_audio(input.data() + offset, output.data() + offset, bench_block_size);
+    }
+
+    int min_latency = INT32_MAX, max_latency = INT32_MIN;
+
+    for(size_t time : note_times) {
+        float peak = 0.0f;
+        for(size_t i = time; i < time + note_length; i++) peak = std::max(peak, std::abs(output[i]));
+
+        // The onset is where the output first gets within 20 dB of the note's peak
+        size_t onset = time - bench_block_size;
+        while(onset < time + note_length && std::abs(output[onset]) < peak * 0.1f) onset++;
+
+        int latency = static_cast<int>(onset) - static_cast<int>(time);
+        printf("  note at %6zu (block offset %3zu): onset at %6zu, %+d samples\n", time, time % bench_block_size, onset, latency);
+
+        min_latency = std::min(min_latency, latency);
+        max_latency = std::max(max_latency, latency);
+    }
+
+    bool passed = true;
+    passed &= check("earliest onset (samples)", min_latency, 0, bench_block_size);
+    passed &= check("onset spread (samples)", max_latency - min_latency, 0, 1);
+
+    return passed;
+}
+
+// Fast bursts of notes on a large voice pool, where every new note has to steal. Checks the stealing
+// order and times note on and off, which used to scan every voice several times.
+static bool bench_voices()
+{
+    printf("voices\n");
+
+    constexpr size_t pool_size = 64;
+    static VoiceManager<pool_size, num_voice_harmonics, num_voice_cascades> pool;
+    pool.init(sample_rate);
+
+    bool passed = true;
+
+    // Fill the pool, let one note go, and the next note takes its voice
+    for(size_t i = 0; i < pool_size; i++) pool.note_on(30.0f + i, 100.0f);
+    pool.note_off(40.0f, 0.0f);
+    pool.note_on(20.0f, 100.0f);
+
+    passed &= check("released voice stolen", pool.get_stats().released_stolen, 1, 1);
+    passed &= check("released note cut", pool.is_sounding(40.0f) ? 1 : 0, 0, 0);
+
+    // All voices held, the oldest held note goes, but never the lowest or the highest
+    pool.note_on(10.0f, 100.0f);
+    passed &= check("held voice stolen", pool.get_stats().held_stolen, 1, 1);
+    passed &= check("oldest note cut", pool.is_sounding(30.0f) ? 0 : 1, 1, 1);
+
+    pool.note_on(31.0f, 100.0f);
+    passed &= check("retriggers", pool.get_stats().retriggers, 1, 1);
+    passed &= check("voices used", pool.get_stats().max_active, pool_size, pool_size);
+
+    // Random bursts around two held notes
+    pool.init(sample_rate);
+    pool.note_on(0.0f, 100.0f);
+    pool.note_on(127.0f, 100.0f);
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> note_dist(1, 126);
+    constexpr size_t events = 1000000;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < events; i++) {
+        float note = static_cast<float>(note_dist(rng));
+        if(i % 3 == 2) pool.note_off(note, 0.0f);
+        else pool.note_on(note, 100.0f);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto& stats = pool.get_stats();
+    printf("  %zu voices: %.1f ns per note event, %u of %u note ons stole a held voice\n",
+           pool_size, seconds * 1e9 / events, stats.held_stolen, stats.note_ons);
+
+    passed &= check("lowest and highest kept", (pool.is_sounding(0.0f) ? 1 : 0) + (pool.is_sounding(127.0f) ? 1 : 0), 2, 2);
+    passed &= check("note ons counted", stats.note_ons, 2 + events - events / 3, 2 + events - events / 3);
+
+    return passed;
+}
+
+static MidiEvent make_channel_event(MidiMessageType type, int channel, uint8_t data0, uint8_t data1)
+{
+    MidiEvent event = {};
+    event.type = type;
+    event.channel = channel;
+    event.data[0] = data0;
+    event.data[1] = data1;
+    return event;
+}
+
+// Two notes on their own MPE member channels, excited by noise. Bending one channel moves only its note.
+// Also times a bend on one channel against a bend on the master channel, which rebuilds every voice.
+static bool bench_mpe()
+{
+    printf("mpe\n");
+
+    active_midi_channel = 1;
+    mpe.set_member_channels(MpeZone::max_member_channels);
+
+    voice_handler.init(sample_rate);
+    voice_handler.set_shape(0.0f); // Sine, only the fundamental
+    voice_handler.set_attack(1.0f);
+
+    constexpr size_t num_samples = 1 << 16;
+    constexpr uint8_t bent_note = 60, other_note = 66;
+
+    std::vector<float> input(num_samples);
+    NoiseGenerator noise;
+    noise.init();
+    for(size_t i = 0; i < num_samples; i += bench_block_size) noise.process_block(input.data() + i, bench_block_size);
+
+    handle_midi_message(make_channel_event(NoteOn, 1, bent_note, 100));
+    handle_midi_message(make_channel_event(NoteOn, 2, other_note, 100));
+
+    auto render = [&]() {
+        std::vector<float> output(num_samples);
+        voice_handler.update_filters();
+        for(size_t i = 0; i < num_samples; i += bench_block_size) voice_handler.process_block(input.data() + i, output.data() + i, bench_block_size);
+        return output;
+    };
+
+    std::vector<float> before = render();
+
+    // A bend of a quarter of the range, as the two 7 bit halves of the 14 bit value
+    constexpr int bend_value = 8192 + 2048;
+    handle_midi_message(make_channel_event(PitchBend, 1, bend_value & 127, bend_value >> 7));
+    float bend = 2048.0f / 8192.0f * mpe.member_bend_range;
+
+    std::vector<float> after = render();
+
+    auto change_db = [&](float note) {
+        return 10.0 * log10(power_at(after, mtof(note), 1024) / power_at(before, mtof(note), 1024));
+    };
+
+    printf("  bend of %.1f semitones on one channel\n", bend);
+
+    bool passed = true;
+    passed &= check("bent note, old pitch dB", change_db(bent_note), -1000.0, -15.0);
+    passed &= check("bent note, new pitch dB", change_db(bent_note + bend), 15.0, 1000.0);
+    passed &= check("other note dB", change_db(other_note), -1.0, 1.0);
+
+    // The same note held on two member channels gets a voice each. The two voices ring in phase, so bending
+    // one away takes about 6 dB off the note, and releasing the bent one leaves the other one held.
+    voice_handler.init(sample_rate);
+    voice_handler.set_release(1.0f);
+    handle_midi_message(make_channel_event(NoteOn, 1, bent_note, 100));
+    handle_midi_message(make_channel_event(NoteOn, 2, bent_note, 100));
+
+    before = render();
+    handle_midi_message(make_channel_event(PitchBend, 1, bend_value & 127, bend_value >> 7));
+    after = render();
+
+    passed &= check("same note, retriggers", voice_handler.get_stats().retriggers, 0, 0);
+    passed &= check("same note, old pitch dB", change_db(bent_note), -9.0, -4.0);
+    passed &= check("same note, new pitch dB", change_db(bent_note + bend), 15.0, 1000.0);
+
+    before = after;
+    handle_midi_message(make_channel_event(NoteOff, 1, bent_note, 0));
+    after = render();
+
+    passed &= check("same note, other held dB", change_db(bent_note), -1.0, 1.0);
+    passed &= check("same note, bent released dB", change_db(bent_note + bend), -1000.0, -15.0);
+
+    // Expression on one channel with a voice on every channel
+    voice_handler.init(sample_rate);
+    for(size_t i = 0; i < num_voices; i++) handle_midi_message(make_channel_event(NoteOn, 1 + i, 48 + 5 * i, 100));
+    voice_handler.update_filters();
+
+    constexpr int messages = 20000;
+
+    for(bool master : {false, true}) {
+        auto start = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < messages; i++) {
+            int value = 8192 + (i & 1023);
+            handle_midi_message(make_channel_event(PitchBend, master ? 0 : 1 + i % num_voices, value & 127, value >> 7));
+            voice_handler.update_filters();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("  %s bend: %.2f us per message with %zu voices\n", master ? "master" : "member", seconds * 1e6 / messages, num_voices);
+    }
+
+    voice_handler.init(sample_rate);
+    mpe.set_member_channels(0);
+
+    return passed;
+}
+
+struct Benchmark
+{
+    const char* name;
+    bool (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    {"noise", bench_noise},
+    {"scalar", bench_scalar_reference},
+    {"octave", bench_octave_band},
+    {"delay", bench_delay_line},
+    {"drive", bench_drive},
+    {"onsets", bench_onsets},
+    {"voices", bench_voices},
+    {"mpe", bench_mpe},
+};
+
+int main(int argc, char** argv)
+{
+    bool passed = true;
+    int ran = 0;
+
+    for(auto& benchmark : benchmarks) {
+        // With no arguments everything runs, otherwise only the benchmarks named
+        bool selected = argc < 2;
+        for(int i = 1; i < argc; i++) selected |= strcmp(argv[i], benchmark.name) == 0;
+        if(!selected) continue;
+
+        passed &= benchmark.run();
+        ran++;
+    }
+
+    if(ran == 0) {
+        fprintf(stderr, "usage: recipher_bench [benchmark...]\n\nbenchmarks:");
+        for(auto& benchmark : benchmarks) fprintf(stderr, " %s", benchmark.name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    return passed ? 0 : 1;
+}
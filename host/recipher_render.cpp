@@ -0,0 +1,221 @@
+// Offline renderer: runs the Recipher signal chain from src/Engine.h on a WAV file, driven by
+// a MIDI file and a parameter automation file, and writes the result to a WAV file.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// hid/midi.h normally defines this before including MidiEvent.h
+#define SYSEX_BUFFER_LEN 128
+
+#include "hid/MidiEvent.h"
+#include "hid/ctrl.h"
+#include "hid/parameter.h"
+
+#include "daisysp.h"
+
+using namespace daisysp;
+using namespace daisy;
+
+#include "Engine.h"
+
+#include "Automation.h"
+#include "KnobBank.h"
+#include "MidiFile.h"
+#include "WavFile.h"
+
+struct RenderSettings
+{
+    std::string input_path;
+    std::string midi_path;
+    std::string automation_path;
+    std::string output_path;
+
+    int midi_channel = 1;
+    int mpe_channels = 0;
+    double tail_seconds = 2.0;
+};
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "usage: recipher_render -o output.wav [-i input.wav] [-m notes.mid] [-a automation.txt]\n"
+            "                       [-c midi_channel] [-e mpe_channels] [-t tail_seconds]\n"
+            "\n"
+            "  -i  audio input, silence if omitted (the noise source still runs)\n"
+            "  -m  standard MIDI file with the notes to play\n"
+            "  -a  knob and switch automation, see host/Automation.h for the format\n"
+            "  -c  MIDI channel to listen on, 1 to 16 (default 1)\n"
+            "  -e  MPE member channels after it, 0 to 15 (default 0, MPE off)\n"
+            "  -t  seconds to keep rendering after the last input (default 2)\n");
+}
+
+static bool parse_arguments(int argc, char** argv, RenderSettings& settings)
+{
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if(i + 1 >= argc) return false;
+
+        std::string value = argv[++i];
+
+        if(arg == "-i") settings.input_path = value;
+        else if(arg == "-m") settings.midi_path = value;
+        else if(arg == "-a") settings.automation_path = value;
+        else if(arg == "-o") settings.output_path = value;
+        else if(arg == "-c") settings.midi_channel = atoi(value.c_str());
+        else if(arg == "-e") settings.mpe_channels = atoi(value.c_str());
+        else if(arg == "-t") settings.tail_seconds = atof(value.c_str());
+        else return false;
+    }
+
+    return !settings.output_path.empty() && settings.midi_channel >= 1 && settings.midi_channel <= 16
+        && settings.mpe_channels >= 0 && settings.mpe_channels <= MpeZone::max_member_channels && settings.tail_seconds >= 0.0;
+}
+
+// Prints the time spent per stage, per block and relative to the block duration
+static void print_stats()
+{
+    printf("\n%-16s %10s %10s %10s %8s\n", "Stage", "min (us)", "avg (us)", "max (us)", "avg load");
+
+    for(int i = 0; i < NumProfileStages; i++) {
+        auto& stats = profiler.get_stats(static_cast<ProfileStage>(i));
+        if(!stats.count) continue;
+
+        printf("%-16s %10.2f %10.2f %10.2f %7.3f%%\n", profile_stage_names[i],
+               profiler.get_microseconds(stats.min),
+               profiler.get_microseconds(stats.get_avg()),
+               profiler.get_microseconds(stats.max),
+               profiler.get_load(stats.get_avg()) * 100.0f);
+    }
+
+    auto& voices = voice_handler.get_stats();
+    printf("\nVoices: %u note ons, %u retriggered, %u released stolen, %u held stolen, at most %u of %zu sounding\n",
+           voices.note_ons, voices.retriggers, voices.released_stolen, voices.held_stolen, voices.max_active, num_voices);
+}
+
+int main(int argc, char** argv)
+{
+    RenderSettings settings;
+
+    if(!parse_arguments(argc, argv, settings)) {
+        print_usage();
+        return 1;
+    }
+
+    std::string error;
+
+    WavData input;
+    std::vector<TimedMidiEvent> midi_events;
+    std::vector<AutomationEvent> automation;
+
+    if(!settings.input_path.empty() && !read_wav(settings.input_path, input, error)) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    if(!settings.midi_path.empty() && !read_midi_file(settings.midi_path, midi_events, error)) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    if(!settings.automation_path.empty() && !read_automation(settings.automation_path, automation, error)) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    if(!settings.input_path.empty() && input.sample_rate != static_cast<int>(sample_rate)) {
+        fprintf(stderr, "warning: %s is %d Hz, it will be processed as %d Hz without resampling\n",
+                settings.input_path.c_str(), input.sample_rate, static_cast<int>(sample_rate));
+    }
+
+    // Render until the input, notes and automation are done, plus the tail
+    double end_time = input.samples.size() / sample_rate;
+    if(!midi_events.empty()) end_time = std::max(end_time, midi_events.back().time);
+    if(!automation.empty()) end_time = std::max(end_time, automation.back().time);
+    end_time += settings.tail_seconds;
+
+    size_t num_blocks = static_cast<size_t>(std::ceil(end_time * sample_rate / max_block_size));
+    size_t num_samples = num_blocks * max_block_size;
+
+    input.samples.resize(num_samples, 0.0f);
+    std::vector<float> output(num_samples, 0.0f);
+
+    KnobBank knobs;
+    bool shift = false;
+    bool frozen = false;
+
+    size_t next_automation = 0;
+    size_t next_midi = 0;
+
+    // Like the hardware, controls and MIDI are only looked at when a block starts
+    auto apply_automation = [&](double time) {
+        for(; next_automation < automation.size() && automation[next_automation].time <= time; next_automation++) {
+            auto& event = automation[next_automation];
+
+            switch(event.target) {
+                case AutomationTarget::Knob: knobs.set(event.knob, event.value); break;
+                case AutomationTarget::Shift: shift = event.value != 0.0f; break;
+                case AutomationTarget::Freeze: frozen = event.value != 0.0f; break;
+            }
+        }
+    };
+
+    active_midi_channel = settings.midi_channel;
+    mpe.set_member_channels(settings.mpe_channels);
+
+    apply_automation(0.0);
+
+    SculptParameters::init(shift, knobs);
+    init_engine();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(size_t block = 0; block < num_blocks; block++) {
+        size_t offset = block * max_block_size;
+        double time = offset / sample_rate;
+
+        apply_automation(time);
+
+        // Queue the events in this block the way the Seed's main loop would, stamped with their sample time
+        for(; next_midi < midi_events.size() && midi_events[next_midi].time < time + max_block_size / sample_rate; next_midi++) {
+            uint32_t event_time = static_cast<uint32_t>(lround(midi_events[next_midi].time * sample_rate));
+            if(!queue_midi_event(midi_events[next_midi].event, event_time)) break;
+        }
+
+        profiler.begin_block();
+
+        apply_lfo(max_block_size);
+
+        profiler.lap(StageLfo);
+
+        SculptParameters::set_shift(shift);
+        freeze.set_freeze(frozen);
+
+        update_parameters();
+
+        profiler.lap(StageParameters);
+
+        process_audio(input.samples.data() + offset, output.data() + offset, max_block_size);
+
+        profiler.end_block();
+    }
+
+    double render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double audio_seconds = num_samples / sample_rate;
+
+    if(!write_wav(settings.output_path, output, static_cast<int>(sample_rate), error)) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    printf("Rendered %.2f s of audio in %.3f s (%.1fx real-time)\n", audio_seconds, render_seconds, audio_seconds / render_seconds);
+
+    print_stats();
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #ifndef DSY_SVF_H
 #define DSY_SVF_H
+#include <stddef.h>
 
 namespace daisysp
 {
@@ -31,6 +32,66 @@ class Svf
     */
     void Process(float in);
 
+    /** Outputs that ProcessBlock can compute
+    */
+    enum Output
+    {
+        OUT_LOW,
+        OUT_HIGH,
+        OUT_BAND,
+        OUT_NOTCH,
+        OUT_PEAK,
+    };
+
+    /** Filters size samples from in into out, computing only the selected
+        output. Over the block the cutoff moves to freq_ramp: the internal
+        coefficients are computed for freq_ramp once and interpolated
+        linearly from their current values, instead of being derived
+        from Hz on every sample.
+        With drive false the cubic saturation of the band state is left
+        out, which sounds like SetDrive(0) and saves three multiplies per pass.
+        The Low(), High(), ... outputs are not updated.
+    */
+    template <Output output, bool drive = true>
+    void ProcessBlock(const float* in, float* out, size_t size, float freq_ramp)
+    {
+        if(size == 0)
+            return;
+
+        float freq = freq_;
+        float damp = damp_;
+        SetFreq(freq_ramp);
+        const float scale     = 1.0f / size;
+        const float freq_step = (freq_ - freq) * scale;
+        const float damp_step = (damp_ - damp) * scale;
+
+        // Keep the state in locals so it stays in registers
+        float low  = low_;
+        float band = band_;
+        for(size_t i = 0; i < size; i++)
+        {
+            freq += freq_step;
+            damp += damp_step;
+
+            const float input = in[i];
+            // first pass
+            float notch = input - damp * band;
+            low         = low + freq * band;
+            float high  = notch - low;
+            band        = Integrate<drive>(band, freq * high);
+            float sum = Select<output>(low, high, band, notch);
+            // second pass
+            notch = input - damp * band;
+            low   = low + freq * band;
+            high  = notch - low;
+            band  = Integrate<drive>(band, freq * high);
+            // average both passes
+            out[i] = 0.5f * (sum + Select<output>(low, high, band, notch));
+        }
+        low_  = low;
+        band_ = band;
+    }
+
 
     /** sets the frequency of the cutoff frequency. 
         f must be between 0.0 and sample_rate / 3
@@ -68,6 +129,26 @@ class Svf
     inline float Peak() { return out_peak_; }
 
   private:
+    template <bool drive>
+    inline float Integrate(float band, float delta) const
+    {
+        return drive ? delta + band - drive_ * band * band * band
+                     : delta + band;
+    }
+
+    template <Output output>
+    static inline float Select(float low, float high, float band, float notch)
+    {
+        switch(output)
+        {
+            case OUT_LOW: return low;
+            case OUT_HIGH: return high;
+            case OUT_BAND: return band;
+            case OUT_NOTCH: return notch;
+            default: return low - high;
+        }
+    }
+
     float sr_, fc_, res_, drive_, freq_, damp_;
     float notch_, low_, high_, band_, peak_;
     float input_;
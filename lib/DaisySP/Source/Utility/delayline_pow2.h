@@ -0,0 +1,184 @@
+#pragma once
+#ifndef DSY_DELAY_POW2_H
+#define DSY_DELAY_POW2_H
+#include <stdlib.h>
+#include <stdint.h>
+namespace daisysp
+{
+/** Smallest power of two that is at least x */
+constexpr size_t NextPowerOfTwo(size_t x)
+{
+    size_t result = 1;
+    while(result < x)
+        result <<= 1;
+    return result;
+}
+
+/** Delay line with a power-of-two capacity.
+
+Works like DelayLine, but the buffer is rounded up to the next power of two so
+every access wraps with a mask instead of an integer modulo. It also has block
+functions that read or write a whole block at once.
+
+declaration example: (1 second of floats, 32768 are allocated)
+
+DelayLinePow2<float, SAMPLE_RATE> del;
+*/
+template <typename T, size_t max_size>
+class DelayLinePow2
+{
+  public:
+    /** Number of samples actually allocated, max_size rounded up to a power of two */
+    static constexpr size_t kCapacity = NextPowerOfTwo(max_size);
+
+    DelayLinePow2() {}
+    ~DelayLinePow2() {}
+    /** initializes the delay line by clearing the values within, and setting delay to 1 sample.
+    */
+    void Init() { Reset(); }
+    /** clears buffer, sets write ptr to 0, and delay to 1 sample.
+    */
+    void Reset()
+    {
+        for(size_t i = 0; i < kCapacity; i++)
+        {
+            line_[i] = T(0);
+        }
+        write_ptr_ = 0;
+        delay_     = 1;
+        frac_      = 0.0f;
+    }
+
+    /** sets the delay time in samples
+    */
+    inline void SetDelay(size_t delay)
+    {
+        frac_  = 0.0f;
+        delay_ = delay < max_size ? delay : max_size - 1;
+    }
+
+    /** sets the delay time in samples, the fractional part is interpolated
+    */
+    inline void SetDelay(float delay)
+    {
+        int32_t int_delay = static_cast<int32_t>(delay);
+        frac_             = delay - static_cast<float>(int_delay);
+        delay_ = static_cast<size_t>(int_delay) < max_size ? int_delay
+                                                           : max_size - 1;
+    }
+
+    /** writes the sample of type T to the delay line, and advances the write ptr
+    */
+    inline void Write(const T sample)
+    {
+        line_[write_ptr_] = sample;
+        write_ptr_        = (write_ptr_ - 1) & kMask;
+    }
+
+    /** returns the next sample of type T in the delay line, interpolated if necessary.
+    */
+    inline const T Read() const
+    {
+        T a = line_[(write_ptr_ + delay_) & kMask];
+        T b = line_[(write_ptr_ + delay_ + 1) & kMask];
+        return a + (b - a) * frac_;
+    }
+
+    /** Read from a set location */
+    inline const T Read(float delay) const
+    {
+        int32_t delay_integral   = static_cast<int32_t>(delay);
+        float   delay_fractional = delay - static_cast<float>(delay_integral);
+        const T a = line_[(write_ptr_ + delay_integral) & kMask];
+        const T b = line_[(write_ptr_ + delay_integral + 1) & kMask];
+        return a + (b - a) * delay_fractional;
+    }
+
+    inline const T ReadHermite(float delay) const
+    {
+        return ReadHermiteAt(write_ptr_, delay);
+    }
+
+    inline const T Allpass(const T sample, size_t delay, const T coefficient)
+    {
+        T read  = line_[(write_ptr_ + delay) & kMask];
+        T write = sample + coefficient * read;
+        Write(write);
+        return -write * coefficient + read;
+    }
+
+    /** Writes a block of samples, like calling Write for each of them
+    */
+    void WriteBlock(const T* in, size_t size)
+    {
+        size_t ptr = write_ptr_;
+        for(size_t i = 0; i < size; i++)
+        {
+            line_[ptr] = in[i];
+            ptr        = (ptr - 1) & kMask;
+        }
+        write_ptr_ = ptr;
+    }
+
+    /** Fills out with the samples that ReadHermite would return if it was
+        called before each of the next size Writes, delays holds one delay
+        per sample. The write pointer is not moved.
+        Reads can't see samples written in the same block, so each delay
+        has to be at least size + 1 samples for the result to match.
+    */
+    void ReadHermiteBlock(const float* delays, T* out, size_t size) const
+    {
+        size_t ptr = write_ptr_;
+        for(size_t i = 0; i < size; i++)
+        {
+            out[i] = ReadHermiteAt(ptr, delays[i]);
+            ptr    = (ptr - 1) & kMask;
+        }
+    }
+
+    /** Writes size zeros, like WriteBlock with a silent block. Calling
+        this over several blocks clears the line without the cost of a
+        whole Reset at once.
+    */
+    void WriteZeros(size_t size)
+    {
+        size_t ptr = write_ptr_;
+        for(size_t i = 0; i < size; i++)
+        {
+            line_[ptr] = T(0);
+            ptr        = (ptr - 1) & kMask;
+        }
+        write_ptr_ = ptr;
+    }
+
+  private:
+    static_assert(max_size > 0, "DelayLinePow2 needs at least one sample");
+
+    static constexpr size_t kMask = kCapacity - 1;
+
+    inline const T ReadHermiteAt(size_t ptr, float delay) const
+    {
+        int32_t delay_integral   = static_cast<int32_t>(delay);
+        float   delay_fractional = delay - static_cast<float>(delay_integral);
+
+        size_t      t     = ptr + delay_integral;
+        const T     xm1   = line_[(t - 1) & kMask];
+        const T     x0    = line_[t & kMask];
+        const T     x1    = line_[(t + 1) & kMask];
+        const T     x2    = line_[(t + 2) & kMask];
+        const float c     = (x1 - xm1) * 0.5f;
+        const float v     = x0 - x1;
+        const float w     = c + v;
+        const float a     = w + v + (x2 - x0) * 0.5f;
+        const float b_neg = w + a;
+        const float f     = delay_fractional;
+        return (((a * f) - b_neg) * f + c) * f + x0;
+    }
+
+    float  frac_;
+    size_t write_ptr_;
+    size_t delay_;
+    T      line_[kCapacity];
+};
+} // namespace daisysp
+#endif
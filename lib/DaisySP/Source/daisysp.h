@@ -92,6 +92,7 @@
 /** Utility Modules */
 #include "Utility/dcblock.h"
 #include "Utility/delayline.h"
+#include "Utility/delayline_pow2.h"
 #include "Utility/dsp.h"
 #include "Utility/jitter.h"
 #include "Utility/maytrig.h"
@@ -65,6 +65,7 @@
 #include "util/FixedCapStr.h"
 #include "util/MappedValue.h"
 #include "util/PersistentStorage.h"
+#include "util/SettingsLog.h"
 #include "util/Stack.h"
 #include "util/VoctCalibration.h"
 #include "util/WaveTableLoader.h"
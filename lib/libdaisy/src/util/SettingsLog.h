@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace daisy
+{
+/** CRC-32 (IEEE 802.3, the one used by zip and png)
+ *  \param data bytes to checksum
+ *  \param size number of bytes
+ *  \param crc CRC of the data before this, to checksum data in pieces
+ */
+inline uint32_t Crc32(const void* data, size_t size, uint32_t crc = 0)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc                  = ~crc;
+    for(size_t i = 0; i < size; i++)
+    {
+        crc ^= bytes[i];
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+/** @brief Wear-levelled settings storage on external flash that survives power loss.
+ *
+ *  Every save appends a record to the next free slot of a sector,
+ *  instead of erasing and rewriting the same bytes. A sector is only
+ *  erased when the log moves on to it after the previous sector filled
+ *  up, so each sector is erased once every
+ *  (slots per sector * number of sectors) saves.
+ *
+ *  Each record holds the settings, a format version, a sequence number
+ *  and a CRC32. Init restores the newest record with a valid CRC, so a
+ *  save that was cut off by a power loss leaves the previous settings
+ *  in place. Records with another version are skipped.
+ *
+ *  Init reads the first record of every sector and binary searches the
+ *  newest sector for the end of the log. From then on the end is
+ *  cached, and saving does not have to search.
+ *
+ *  \tparam SettingStruct trivially copyable settings
+ *  \tparam Flash a flash device with QSPIHandle's Erase, Write and GetData.
+ *          Erased flash has to read as 0xff.
+ *  \tparam sector_size erase size of the flash
+ */
+template <typename SettingStruct, typename Flash, uint32_t sector_size = 4096>
+class SettingsLog
+{
+    struct Record
+    {
+        uint32_t      magic;
+        uint16_t      version;
+        uint16_t      size;
+        uint32_t      sequence;
+        SettingStruct settings;
+        uint32_t      crc;
+    };
+
+    static constexpr uint32_t SlotSizeFor(uint32_t record_size)
+    {
+        return record_size <= 16 ? 16 : 2 * SlotSizeFor((record_size + 1) / 2);
+    }
+
+  public:
+    /** Bytes used per save, a power of two so records never cross a flash page */
+    static constexpr uint32_t kSlotSize = SlotSizeFor(sizeof(Record));
+
+    /** Saves that fit in one sector */
+    static constexpr uint32_t kSlotsPerSector = sector_size / kSlotSize;
+
+    static_assert(kSlotSize <= 256, "Settings are too large for a flash page");
+
+    SettingsLog(Flash& flash) : flash_(flash) {}
+
+    /** Finds the newest record in the log.
+     *  \param address start of the flash area used by the log, sector aligned
+     *  \param num_sectors sectors the log uses. With 2 or more, the newest
+     *         record is never in the sector being erased.
+     *  \param version version of the SettingStruct layout, records written
+     *         with another version are not restored
+     *  \return true if settings were restored
+     */
+    bool Init(uint32_t address, uint32_t num_sectors, uint16_t version)
+    {
+        address_      = address;
+        num_sectors_  = num_sectors;
+        version_      = version;
+        has_settings_ = false;
+        erase_count_  = 0;
+
+        // The sector whose first record is the newest holds the end of the log
+        uint32_t newest_sector   = num_sectors_;
+        uint32_t newest_sequence = 0;
+        Record   record;
+
+        for(uint32_t sector = 0; sector < num_sectors_; sector++)
+        {
+            if(!ReadRecord(sector, 0, record))
+                continue;
+
+            // Compared as a difference, so the sequence can wrap
+            if(newest_sector == num_sectors_
+               || static_cast<int32_t>(record.sequence - newest_sequence) > 0)
+            {
+                newest_sector   = sector;
+                newest_sequence = record.sequence;
+            }
+        }
+
+        if(newest_sector == num_sectors_)
+        {
+            // Empty, the first save starts the log in sector 0
+            tail_sector_   = num_sectors_ - 1;
+            tail_slot_     = kSlotsPerSector;
+            next_sequence_ = 0;
+            return false;
+        }
+
+        // Slots are filled in order, so the free ones are at the end of the sector
+        uint32_t low = 1, high = kSlotsPerSector;
+        while(low < high)
+        {
+            uint32_t middle = (low + high) / 2;
+            if(IsFree(newest_sector, middle))
+                high = middle;
+            else
+                low = middle + 1;
+        }
+
+        tail_sector_ = newest_sector;
+        tail_slot_   = low;
+
+        // The last slot may hold an interrupted save, slot 0 is known to be valid
+        uint32_t slot = tail_slot_;
+        while(!ReadRecord(tail_sector_, --slot, record)) {}
+
+        next_sequence_ = record.sequence + 1;
+
+        if(record.version == version_)
+        {
+            settings_     = record.settings;
+            has_settings_ = true;
+        }
+
+        return has_settings_;
+    }
+
+    /** Whether GetSettings holds restored or saved settings */
+    bool HasSettings() const { return has_settings_; }
+
+    /** Returns the settings restored by Init, or the last ones saved */
+    const SettingStruct& GetSettings() const { return settings_; }
+
+    /** Appends settings to the log.
+     *  \return false if the record did not read back correctly. The next
+     *          save then starts a new sector, so the slots of a sector
+     *          are always written in order.
+     */
+    bool Save(const SettingStruct& settings)
+    {
+        if(tail_slot_ >= kSlotsPerSector)
+        {
+            tail_sector_ = (tail_sector_ + 1) % num_sectors_;
+            tail_slot_   = 0;
+
+            uint32_t sector_address = SlotAddress(tail_sector_, 0);
+            flash_.Erase(sector_address, sector_address + sector_size);
+            erase_count_++;
+        }
+
+        // Zeroed first, so the padding that the CRC covers is defined
+        Record record;
+        memset(&record, 0, sizeof(record));
+        record.magic    = kMagic;
+        record.version  = version_;
+        record.size     = sizeof(SettingStruct);
+        record.sequence = next_sequence_;
+        record.settings = settings;
+        record.crc      = Crc32(&record, offsetof(Record, crc));
+
+        uint32_t slot = tail_slot_++;
+        flash_.Write(SlotAddress(tail_sector_, slot),
+                     sizeof(record),
+                     reinterpret_cast<uint8_t*>(&record));
+
+        Record written;
+        if(!ReadRecord(tail_sector_, slot, written)
+           || written.sequence != next_sequence_)
+        {
+            tail_slot_ = kSlotsPerSector;
+            return false;
+        }
+
+        next_sequence_++;
+        settings_     = settings;
+        has_settings_ = true;
+        return true;
+    }
+
+    /** Sectors erased since Init */
+    uint32_t GetEraseCount() const { return erase_count_; }
+
+  private:
+    static constexpr uint32_t kMagic = 0x474f4c53; // "SLOG"
+
+    uint32_t SlotAddress(uint32_t sector, uint32_t slot) const
+    {
+        return address_ + sector * sector_size + slot * kSlotSize;
+    }
+
+    // True if the slot holds a complete record, checked against its CRC
+    bool ReadRecord(uint32_t sector, uint32_t slot, Record& record)
+    {
+        memcpy(&record,
+               flash_.GetData(SlotAddress(sector, slot)),
+               sizeof(record));
+
+        return record.magic == kMagic && record.size == sizeof(SettingStruct)
+               && record.crc == Crc32(&record, offsetof(Record, crc));
+    }
+
+    // True if nothing was written to the slot since its sector was erased
+    bool IsFree(uint32_t sector, uint32_t slot)
+    {
+        auto* bytes = static_cast<const uint8_t*>(
+            flash_.GetData(SlotAddress(sector, slot)));
+
+        for(uint32_t i = 0; i < kSlotSize; i++)
+        {
+            if(bytes[i] != 0xff)
+                return false;
+        }
+        return true;
+    }
+
+    Flash&        flash_;
+    uint32_t      address_       = 0;
+    uint32_t      num_sectors_   = 0;
+    uint16_t      version_       = 0;
+    uint32_t      tail_sector_   = 0;
+    uint32_t      tail_slot_     = 0;
+    uint32_t      next_sequence_ = 0;
+    uint32_t      erase_count_   = 0;
+    bool          has_settings_  = false;
+    SettingStruct settings_      = {};
+};
+
+} // namespace daisy
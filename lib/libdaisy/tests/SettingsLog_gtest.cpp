@@ -0,0 +1,274 @@
+#include "util/SettingsLog.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace daisy;
+
+/** NOR flash in RAM: erasing sets bits, writing can only clear them.
+ *  A write can be cut short to simulate losing power halfway through.
+ */
+class RamFlash
+{
+  public:
+    enum class Result
+    {
+        OK,
+        ERR
+    };
+
+    static constexpr uint32_t kBase       = 0x90040000;
+    static constexpr uint32_t kSectorSize = 4096;
+
+    RamFlash(uint32_t num_sectors) : memory_(num_sectors * kSectorSize, 0x00)
+    {
+    }
+
+    Result Erase(uint32_t start_addr, uint32_t end_addr)
+    {
+        EXPECT_EQ((start_addr - kBase) % kSectorSize, 0u);
+        EXPECT_EQ((end_addr - kBase) % kSectorSize, 0u);
+
+        for(uint32_t addr = start_addr; addr < end_addr; addr++)
+            memory_.at(addr - kBase) = 0xff;
+        erase_count_++;
+        return Result::OK;
+    }
+
+    Result Write(uint32_t address, uint32_t size, uint8_t* buffer)
+    {
+        if(write_limit_ >= 0 && size > static_cast<uint32_t>(write_limit_))
+            size = write_limit_;
+
+        for(uint32_t i = 0; i < size; i++)
+            memory_.at(address - kBase + i) &= buffer[i];
+        return Result::OK;
+    }
+
+    void* GetData(uint32_t offset) { return &memory_.at(offset - kBase); }
+
+    /** Only the first bytes of the next writes reach the flash, -1 for all */
+    void SetWriteLimit(int bytes) { write_limit_ = bytes; }
+
+    uint8_t& At(uint32_t address) { return memory_.at(address - kBase); }
+
+    uint32_t GetEraseCount() const { return erase_count_; }
+
+  private:
+    std::vector<uint8_t> memory_;
+    uint32_t             erase_count_ = 0;
+    int                  write_limit_ = -1;
+};
+
+struct LogTestData
+{
+    uint32_t a;
+    uint8_t  b;
+};
+
+using LogTestClass = SettingsLog<LogTestData, RamFlash>;
+
+class util_SettingsLog : public ::testing::Test
+{
+  protected:
+    static constexpr uint32_t kSectors = 4;
+    static constexpr uint16_t kVersion = 3;
+
+    RamFlash flash_{kSectors};
+
+    /** Boots a fresh instance on the flash, like after a power cycle */
+    bool Restore(LogTestData& data, uint16_t version = kVersion)
+    {
+        LogTestClass log(flash_);
+        bool         found = log.Init(RamFlash::kBase, kSectors, version);
+        data               = log.GetSettings();
+        return found;
+    }
+};
+
+TEST_F(util_SettingsLog, a_emptyFlash)
+{
+    // Blank flash reads as 0xff, but the stand-in starts as zeroes; neither is a record
+    LogTestData data;
+    EXPECT_FALSE(Restore(data));
+
+    for(uint32_t i = 0; i < kSectors * RamFlash::kSectorSize; i++)
+        flash_.At(RamFlash::kBase + i) = 0xff;
+    EXPECT_FALSE(Restore(data));
+}
+
+TEST_F(util_SettingsLog, b_saveAndRestore)
+{
+    LogTestClass log(flash_);
+    log.Init(RamFlash::kBase, kSectors, kVersion);
+    EXPECT_FALSE(log.HasSettings());
+
+    EXPECT_TRUE(log.Save({1, 2}));
+    EXPECT_TRUE(log.Save({3, 4}));
+    EXPECT_TRUE(log.HasSettings());
+    EXPECT_EQ(log.GetSettings().a, 3u);
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, 3u);
+    EXPECT_EQ(data.b, 4);
+}
+
+TEST_F(util_SettingsLog, c_appendsAfterRestore)
+{
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion);
+        log.Save({1, 0});
+    }
+
+    // A second boot continues the log instead of overwriting the first record
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion);
+        log.Save({2, 0});
+    }
+
+    EXPECT_EQ(flash_.GetEraseCount(), 1u);
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, 2u);
+}
+
+TEST_F(util_SettingsLog, d_wrapsAroundSectors)
+{
+    LogTestClass log(flash_);
+    log.Init(RamFlash::kBase, kSectors, kVersion);
+
+    // Two and a half trips around the flash
+    const uint32_t saves = LogTestClass::kSlotsPerSector * kSectors * 5 / 2;
+    for(uint32_t i = 0; i < saves; i++)
+    {
+        ASSERT_TRUE(log.Save({i, static_cast<uint8_t>(i)}));
+
+        // Every boot on the way finds the last save
+        if(i % 97 == 0)
+        {
+            LogTestData data;
+            EXPECT_TRUE(Restore(data));
+            EXPECT_EQ(data.a, i);
+        }
+    }
+
+    // One erase per sector filled, instead of one per save
+    const uint32_t erases = (saves + LogTestClass::kSlotsPerSector - 1)
+                            / LogTestClass::kSlotsPerSector;
+    EXPECT_EQ(log.GetEraseCount(), erases);
+    EXPECT_EQ(flash_.GetEraseCount(), erases);
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, saves - 1);
+}
+
+TEST_F(util_SettingsLog, e_powerLossDuringWrite)
+{
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion);
+
+        // Fill the first sector exactly, so the next save also erases a sector
+        for(uint32_t i = 0; i < LogTestClass::kSlotsPerSector; i++)
+            log.Save({i, 0});
+    }
+
+    // Cut off in the first slot of the new sector, and then in later ones
+    for(int bytes : {1, 15, 0, 4, 12, 15})
+    {
+        {
+            LogTestClass log(flash_);
+            log.Init(RamFlash::kBase, kSectors, kVersion);
+            flash_.SetWriteLimit(bytes);
+            EXPECT_FALSE(log.Save({1000, 0}));
+            flash_.SetWriteLimit(-1);
+        }
+
+        LogTestData data;
+        EXPECT_TRUE(Restore(data));
+        EXPECT_EQ(data.a, LogTestClass::kSlotsPerSector - 1);
+    }
+
+    // The next boot saves past the damaged slots and is found again
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion);
+        EXPECT_TRUE(log.Save({2000, 0}));
+        EXPECT_TRUE(log.Save({3000, 0}));
+    }
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, 3000u);
+}
+
+TEST_F(util_SettingsLog, f_failedWriteStartsNewSector)
+{
+    LogTestClass log(flash_);
+    log.Init(RamFlash::kBase, kSectors, kVersion);
+    log.Save({1, 0});
+
+    flash_.SetWriteLimit(0);
+    EXPECT_FALSE(log.Save({2, 0}));
+    flash_.SetWriteLimit(-1);
+
+    // Without a reboot, the log moves on to a new sector instead of writing past the hole
+    EXPECT_TRUE(log.Save({3, 0}));
+    EXPECT_EQ(log.GetEraseCount(), 2u);
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, 3u);
+}
+
+TEST_F(util_SettingsLog, g_corruptRecordIgnored)
+{
+    LogTestClass log(flash_);
+    log.Init(RamFlash::kBase, kSectors, kVersion);
+    log.Save({1, 0});
+    log.Save({2, 0});
+
+    // Flip a bit in the settings of the second record
+    flash_.At(RamFlash::kBase + LogTestClass::kSlotSize + 12) ^= 0x01;
+
+    LogTestData data;
+    EXPECT_TRUE(Restore(data));
+    EXPECT_EQ(data.a, 1u);
+}
+
+TEST_F(util_SettingsLog, h_otherVersionIgnored)
+{
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion);
+        log.Save({1, 0});
+    }
+
+    LogTestData data;
+    EXPECT_FALSE(Restore(data, kVersion + 1));
+
+    // Saving with the new version continues the same log
+    {
+        LogTestClass log(flash_);
+        log.Init(RamFlash::kBase, kSectors, kVersion + 1);
+        log.Save({2, 0});
+    }
+
+    EXPECT_TRUE(Restore(data, kVersion + 1));
+    EXPECT_EQ(data.a, 2u);
+    EXPECT_EQ(flash_.GetEraseCount(), 1u);
+}
+
+TEST(util_SettingsLog_Crc32, a_checkValue)
+{
+    // The standard check value for CRC-32
+    const char* digits = "123456789";
+    EXPECT_EQ(Crc32(digits, 9), 0xCBF43926u);
+
+    // Checksumming in pieces gives the same result
+    EXPECT_EQ(Crc32(digits + 4, 5, Crc32(digits, 4)), 0xCBF43926u);
+}
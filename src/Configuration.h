@@ -1,64 +1,101 @@
+#pragma once
+
+// Settings that the settings app changes over SysEx, kept in QSPI flash.
+// Changing a setting only updates the copy in RAM. The main loop writes it to flash once it has stopped
+// changing for a while, so a burst of SysEx messages costs one write, and a sector erase never holds up
+// the audio callback. Saves are appended to a SettingsLog, which only erases a sector once it is full
+// and restores the newest record with a valid CRC, so a save cut short by a power loss is skipped.
 
 struct Configuration {
-    
-    bool initialised;
+
     uint8_t midi_channel;
     uint8_t param_mode;
     uint8_t lfo_dest[3];
+    uint8_t mpe_channels; // Member channels of the MPE zone, 0 for off
+
+    bool same_values(const Configuration& other) const {
+        return midi_channel == other.midi_channel && param_mode == other.param_mode
+            && lfo_dest[0] == other.lfo_dest[0] && lfo_dest[1] == other.lfo_dest[1] && lfo_dest[2] == other.lfo_dest[2]
+            && mpe_channels == other.mpe_channels;
+    }
 };
 
-uint8_t DSY_QSPI_BSS config[6];
+class SettingsStore
+{
+public:
+    static constexpr uint32_t num_sectors = 4;
+    static constexpr uint32_t sector_size = 4096; // One QSPI sector
+
+    // Bump when the layout of Configuration changes, records with another version are ignored
+    static constexpr uint16_t version = 2;
 
-void init_configuration() {
-    
-    auto* config_data = static_cast<uint8_t*>(sculpt.qspi.GetData());
+    // The settings app offers channels up to 64
+    static constexpr uint8_t max_midi_channel = 64;
 
-    uint8_t new_config[6];
+    // Changes are written once no other change came in for this long
+    static constexpr uint32_t settle_time_ms = 1000;
 
-    for(int i = 0; i < 6; i++) new_config[i] = config_data[i];
-    // In case there are no settings in memory we can load
-    if(!config_data[0]) {
-        new_config[0] = true;
-        new_config[1] = 0;
-        new_config[2] = 0;
-        new_config[3] = static_cast<int>(ParameterPin::LPF_NOTE);
-        new_config[4] = static_cast<int>(ParameterPin::DELAY);
-        new_config[5] = static_cast<int>(ParameterPin::FREEZE_SIZE);
+    void init(uint32_t flash_address)
+    {
+        Configuration defaults = {0, PICKUP, {LPF_NOTE, DELAY, FREEZE_SIZE}, 0};
+
+        saved = log.Init(flash_address, num_sectors, version) ? log.GetSettings() : defaults;
+        validate(saved, defaults);
+
+        settings = saved;
+        dirty = false;
     }
-    
-    if(config[1] > 64) new_config[1] = 0;
-    if(config[2] > 1)  new_config[2] = 0;
-    if(config[3] > 35) new_config[3] = static_cast<int>(ParameterPin::LPF_NOTE);
-    if(config[4] > 35) new_config[4] = static_cast<int>(ParameterPin::DELAY);
-    if(config[5] > 35) new_config[5] = static_cast<int>(ParameterPin::FREEZE_SIZE);
-
-    size_t size = sizeof(config[0]) * 6;
-    size_t address = (size_t)config;
-    /** Erase qspi and then write that wave */
-    sculpt.qspi.Erase(address, address + size);
-    sculpt.qspi.Write(address, size, (uint8_t*)new_config);
-}
-
-std::array<int, 5> read_settings() {
-    auto* config_data = static_cast<uint8_t*>(sculpt.qspi.GetData());
-    return {config_data[1], config_data[2], config_data[3], config_data[4], config_data[5]};
-}
-
-void write_settings(int midi_channel, int param_mode, int lfo_dest_1, int lfo_dest_2, int lfo_dest_3)
-{
-    uint8_t new_config[6];
 
-    new_config[1] = static_cast<uint8_t>(midi_channel);
-    new_config[2] = static_cast<uint8_t>(param_mode);
-    new_config[3] = static_cast<uint8_t>(lfo_dest_1);
-    new_config[4] = static_cast<uint8_t>(lfo_dest_2);
-    new_config[5] = static_cast<uint8_t>(lfo_dest_3);
+    const Configuration& get() const { return settings; }
+
+    // Takes effect right away, the write to flash happens later in update()
+    void set(const Configuration& values)
+    {
+        if(values.same_values(settings)) return;
+
+        settings = values;
+
+        dirty = true;
+        last_change = System::GetNow();
+    }
+
+    // Call from the main loop. Writes the settings once they have settled, if they differ from what's in flash.
+    void update()
+    {
+        if(!dirty || System::GetNow() - last_change < settle_time_ms) return;
+
+        dirty = false;
+
+        // Changed and changed back
+        if(settings.same_values(saved)) return;
+
+        log.Save(settings);
+        saved = settings;
+    }
 
-    size_t size = sizeof(config[0]) * 6;
-    size_t address = (size_t)config;
-    /** Erase qspi and then write that wave */
-    sculpt.qspi.Erase(address, address + size);
-    sculpt.qspi.Write(address, size, (uint8_t*)new_config);
+private:
+    // Replaces anything out of range. The CRC catches damaged records, but not bad values sent over SysEx.
+    static void validate(Configuration& config, const Configuration& defaults)
+    {
+        if(config.midi_channel > max_midi_channel) config.midi_channel = defaults.midi_channel;
+        if(config.param_mode > TOUCH) config.param_mode = defaults.param_mode;
+        if(config.mpe_channels > MpeZone::max_member_channels) config.mpe_channels = defaults.mpe_channels;
+
+        for(int i = 0; i < 3; i++) {
+            if(config.lfo_dest[i] < MIX || config.lfo_dest[i] > LFO_DEST) config.lfo_dest[i] = defaults.lfo_dest[i];
+        }
+    }
+
+    SettingsLog<Configuration, QSPIHandle, sector_size> log{sculpt.qspi};
+
+    Configuration settings;
+    Configuration saved;
+
+    bool dirty = false;
+    uint32_t last_change = 0;
+};
 
+// Flash for the settings log, sector aligned
+uint8_t DSY_QSPI_BSS __attribute__((aligned(SettingsStore::sector_size))) settings_flash[SettingsStore::num_sectors * SettingsStore::sector_size];
 
-}
+SettingsStore settings_store;
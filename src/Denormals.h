@@ -0,0 +1,40 @@
+#pragma once
+
+// Keeps decaying filter states out of the denormal range, where every operation gets slow on the host
+// and the results are noise anyway. Where the FPU can flush denormals to zero we turn that on, otherwise
+// the resonators add a tiny DC offset to their input so their states never decay that far.
+
+#include <stdint.h>
+
+#if defined(RECIPHER_HOST) && (defined(__SSE__) || defined(_M_X64))
+#include <xmmintrin.h>
+#include <pmmintrin.h>
+constexpr bool has_flush_to_zero = true;
+#elif defined(RECIPHER_HOST) && defined(__aarch64__)
+constexpr bool has_flush_to_zero = true;
+#elif !defined(RECIPHER_HOST)
+constexpr bool has_flush_to_zero = true; // Cortex-M7 FPU
+#else
+constexpr bool has_flush_to_zero = false;
+#endif
+
+// Added to resonator inputs when denormals can't be flushed, far below anything audible
+constexpr float denormal_offset = has_flush_to_zero ? 0.0f : 1e-18f;
+
+// Sets flush-to-zero and denormals-are-zero for the calling thread, call from init before audio starts
+inline void enable_flush_to_zero()
+{
+#if defined(RECIPHER_HOST) && (defined(__SSE__) || defined(_M_X64))
+    _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+    _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+#elif defined(RECIPHER_HOST) && defined(__aarch64__)
+    uint64_t fpcr;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    asm volatile("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+#elif !defined(RECIPHER_HOST)
+    // The audio callback runs in an interrupt, which starts with the FPSCR from FPDSCR,
+    // so set flush-to-zero in both
+    __set_FPSCR(__get_FPSCR() | (1UL << 24)); // FZ bit
+    FPU->FPDSCR |= FPU_FPDSCR_FZ_Msk;
+#endif
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+// Drive stage: a polynomial soft clipper run at 2x or 4x the sample rate, followed by a gain that brings
+// the level back to that of the clean signal.
+// Clipping creates harmonics far above the input, which fold back below nyquist as inharmonic aliases
+// unless the clipper runs at a higher rate. The signal is upsampled and downsampled in 2x steps with a
+// polyphase halfband filter: half of its taps are zero and the centre tap is a half, so each step
+// only multiplies by the remaining taps, and the downsampler only computes the samples it keeps.
+// The level matching follows the mean square of the clean and the driven signal like daisysp::Balance,
+// but once per block, with the gain ramped across the block.
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Smoother.h"
+
+// Halfband lowpass at a quarter of the rate it runs at, a Kaiser windowed sinc. Only the odd taps on one
+// side of the centre are stored, the filter is symmetric.
+struct Halfband
+{
+    static constexpr int half_taps = 8;
+    static constexpr int length = 4 * half_taps - 1;
+
+    Halfband()
+    {
+        constexpr float beta = 8.0f;
+        float sum = 0.0f;
+
+        for(int m = 0; m < half_taps; m++) {
+            int offset = 2 * m + 1;
+            float position = static_cast<float>(offset) / (length / 2 + 1);
+            float window = bessel_i0(beta * sqrtf(1.0f - position * position)) / bessel_i0(beta);
+
+            taps[m] = sinf(static_cast<float>(M_PI) * offset / 2.0f) / (static_cast<float>(M_PI) * offset) * window;
+            sum += taps[m];
+        }
+
+        // Unity gain at DC: with the centre tap at a half, the other taps on each side add up to a quarter
+        for(float& tap : taps) tap *= 0.25f / sum;
+    }
+
+    static const Halfband& get()
+    {
+        static const Halfband halfband;
+        return halfband;
+    }
+
+    float taps[half_taps];
+
+private:
+    static float bessel_i0(float x)
+    {
+        float term = 1.0f, sum = 1.0f;
+        for(int k = 1; k < 20; k++) {
+            term *= (x / (2.0f * k)) * (x / (2.0f * k));
+            sum += term;
+        }
+        return sum;
+    }
+};
+
+// Doubles the sample rate of a block, for blocks of up to max_size samples
+template <size_t max_size>
+struct Upsampler2x
+{
+    void reset()
+    {
+        memset(buffer, 0, sizeof(buffer));
+    }
+
+    // out gets 2 * size samples
+    void process(const float* in, float* out, size_t size)
+    {
+        const float* taps = Halfband::get().taps;
+
+        memcpy(buffer + history, in, size * sizeof(float));
+
+        for(size_t n = 0; n < size; n++) {
+            // The centre of the taps, the input sample half_taps samples back
+            const float* centre = buffer + n + history - Halfband::half_taps;
+
+            float between = 0.0f;
+            for(int m = 0; m < Halfband::half_taps; m++) between += taps[m] * (centre[-m] + centre[m + 1]);
+
+            out[2 * n] = centre[0];
+            out[2 * n + 1] = 2.0f * between;
+        }
+
+        memmove(buffer, buffer + size, history * sizeof(float));
+    }
+
+private:
+    static constexpr size_t history = 2 * Halfband::half_taps - 1;
+
+    float buffer[history + max_size] = {};
+};
+
+// Halves the sample rate of a block, for blocks of up to max_size samples at the lower rate
+template <size_t max_size>
+struct Downsampler2x
+{
+    void reset()
+    {
+        memset(buffer, 0, sizeof(buffer));
+    }
+
+    // in has 2 * size samples
+    void process(const float* in, float* out, size_t size)
+    {
+        const float* taps = Halfband::get().taps;
+
+        memcpy(buffer + history, in, 2 * size * sizeof(float));
+
+        for(size_t n = 0; n < size; n++) {
+            const float* centre = buffer + 2 * n + 1 + history - (Halfband::length / 2);
+
+            float sum = 0.5f * centre[0];
+            for(int m = 0; m < Halfband::half_taps; m++) sum += taps[m] * (centre[-2 * m - 1] + centre[2 * m + 1]);
+
+            out[n] = sum;
+        }
+
+        memmove(buffer, buffer + 2 * size, history * sizeof(float));
+    }
+
+private:
+    static constexpr size_t history = Halfband::length - 1;
+
+    float buffer[history + 2 * max_size] = {};
+};
+
+template <size_t max_block_size>
+struct Drive
+{
+    static constexpr int max_oversampling = 4;
+
+    void init(float sample_rate)
+    {
+        // The same 10 Hz smoothing as daisysp::Balance
+        float coefficient = 1.0f - expf(-2.0f * static_cast<float>(M_PI) * 10.0f / sample_rate);
+        clean_power.init(coefficient, 0.0f);
+        driven_power.init(coefficient, 0.0f);
+
+        set_drive(0.5f);
+        reset();
+    }
+
+    void reset()
+    {
+        up_first.reset();
+        up_second.reset();
+        down_first.reset();
+        down_second.reset();
+
+        clean_power.snap(0.0f);
+        driven_power.snap(0.0f);
+
+        // Start from the gain that matches quiet signals, which the clipper passes through linearly,
+        // so a sound starting after silence is at the right level wherever it starts in the block
+        gain = pre_gain > 0.0f ? 1.0f / (pre_gain * post_gain) : 1.0f;
+    }
+
+    // 1, 2 or 4
+    void set_oversampling(int factor)
+    {
+        oversampling = factor >= 4 ? 4 : (factor >= 2 ? 2 : 1);
+    }
+
+    // Gain staging from daisysp::Overdrive, 0 to 1
+    void set_drive(float drive)
+    {
+        drive = 2.0f * (drive < 0.0f ? 0.0f : (drive > 1.0f ? 1.0f : drive));
+
+        float level = sqrtf(clean_power.get_value());
+        float previous_level = driven_level(level);
+
+        float drive_2 = drive * drive;
+        float pre_gain_a = drive * 0.5f;
+        float pre_gain_b = drive_2 * drive_2 * drive * 24.0f;
+        pre_gain = pre_gain_a + (pre_gain_b - pre_gain_a) * drive_2;
+
+        float drive_squashed = drive * (2.0f - drive);
+        post_gain = 1.0f / shape(0.33f + drive_squashed * (pre_gain - 0.33f));
+
+        // The followers take a while to see a change in drive, and until then the gain would be off by
+        // the change in level. Take an estimate of that change out of them right away.
+        if(previous_level > 0.0f && level > 0.0f) {
+            float change = driven_level(level) / previous_level;
+            gain /= change;
+            driven_power.snap(driven_power.get_value() * change * change);
+        }
+    }
+
+    void process_block(float* buffer, size_t size)
+    {
+        // Measured right around the clipper, so the resampling delay doesn't put the two signals out of step
+        float clean_sum = 0.0f;
+        float driven_sum = 0.0f;
+
+        if(oversampling == 1) {
+            clip(buffer, size, clean_sum, driven_sum);
+        }
+        else {
+            // At 4x the 2x signal sits in the upper half of the buffer. The resamplers copy their input
+            // before writing any output, so it doesn't matter that the stages share the buffer.
+            float* doubled = oversampling == 4 ? oversampled + 2 * max_block_size : oversampled;
+
+            up_first.process(buffer, doubled, size);
+            if(oversampling == 4) up_second.process(doubled, oversampled, 2 * size);
+
+            clip(oversampled, size * oversampling, clean_sum, driven_sum);
+
+            if(oversampling == 4) down_second.process(oversampled, doubled, 2 * size);
+            down_first.process(doubled, buffer, size);
+        }
+
+        // Match the level of the clean signal, one square root and division per block
+        float scale = 1.0f / (size * oversampling);
+        float clean = clean_power.process(clean_sum * scale, size);
+        float driven = driven_power.process(driven_sum * scale, size);
+        float target = driven > 0.0f ? sqrtf(clean / driven) : gain;
+
+        float step = (target - gain) / size;
+        for(size_t i = 0; i < size; i++) buffer[i] *= gain + step * (i + 1);
+
+        gain = target;
+    }
+
+    // The clipping curve: x - 4/27 x^3, which flattens out at 1 for |x| = 1.5 and stays there
+    static inline float shape(float x)
+    {
+        x = x < -1.5f ? -1.5f : (x > 1.5f ? 1.5f : x);
+        return x * (1.0f - (4.0f / 27.0f) * x * x);
+    }
+
+private:
+    // Rough level of the clipper's output for a clean level, linear up to where it clips
+    float driven_level(float clean_level) const
+    {
+        float level = clean_level * pre_gain;
+        return (level < 1.0f ? level : 1.0f) * post_gain;
+    }
+
+    void clip(float* buffer, size_t size, float& clean_sum, float& driven_sum)
+    {
+        for(size_t i = 0; i < size; i++) {
+            float clean = buffer[i];
+            buffer[i] = shape(clean * pre_gain) * post_gain;
+
+            clean_sum += clean * clean;
+            driven_sum += buffer[i] * buffer[i];
+        }
+    }
+
+    // The second stage runs at twice the rate of the first, from 2x to 4x
+    Upsampler2x<max_block_size> up_first;
+    Upsampler2x<2 * max_block_size> up_second;
+    Downsampler2x<2 * max_block_size> down_second;
+    Downsampler2x<max_block_size> down_first;
+
+    float oversampled[max_block_size * max_oversampling];
+
+    int oversampling = 2;
+
+    float pre_gain = 1.0f;
+    float post_gain = 1.0f;
+
+    // Mean square of the clean and the driven signal
+    BlockSmoother clean_power;
+    BlockSmoother driven_power;
+    float gain = 0.0f;
+};
@@ -0,0 +1,494 @@
+#pragma once
+
+// The Recipher signal chain, kept free of hardware so it can run on the Seed and in the offline renderer.
+// Include after daisysp.h and the daisy control and MIDI headers, with both namespaces in scope.
+
+constexpr float sample_rate = 32000.0f;
+constexpr float block_size = 256;
+
+// One second of delay max
+constexpr int max_delay_samples = sample_rate;
+
+// Host builds have no SDRAM section
+#ifndef DSY_SDRAM_BSS
+#define DSY_SDRAM_BSS
+#endif
+
+#include <atomic>
+
+// Settings that the main loop changes from SysEx while the audio callback reads them are atomic
+std::atomic<int> active_midi_channel{1};
+
+#include "ShapeFilter.h"
+#include "VoiceConfig.h"
+#include "Freeze.h"
+#include "Parameters.h"
+#include "LFO.h"
+#include "VoiceManager.h"
+#include "Profiler.h"
+#include "SilenceDetector.h"
+#include "Smoother.h"
+#include "Noise.h"
+#include "Drive.h"
+#include "EventQueue.h"
+#include "Mpe.h"
+
+Svf filt;
+LFO lfo = LFO(sample_rate);
+
+Drive<max_block_size> drive;
+
+// About four seconds of input for the freeze loop, in SDRAM on the Seed
+constexpr int freeze_capture_samples = 1 << 17;
+
+float DSY_SDRAM_BSS freeze_buffer[freeze_capture_samples];
+Freeze<freeze_capture_samples> freeze;
+
+// One second maximum for delay time
+DelayLinePow2<float, max_delay_samples> delay;
+
+static VoiceManager<num_voices, num_voice_harmonics, num_voice_cascades> voice_handler;
+
+// The master channel is active_midi_channel
+MpeZone mpe;
+
+Profiler profiler;
+
+SilenceDetector delay_silence;
+// Samples of the delay line still to clear after it fell asleep, a block at a time
+size_t delay_samples_to_clear = 0;
+SilenceDetector drive_silence;
+SilenceDetector output_silence;
+
+float input_buffer[max_block_size];
+float synth_buffer[max_block_size];
+
+// Excitation noise, mixed with the audio input
+NoiseGenerator noise;
+
+// Delay time and output filter cutoff follow their knobs smoothly, computed once per block
+BlockSmoother delay_smoother;
+BlockSmoother cutoff_smoother;
+
+float drive_amt = 1.0f;
+float stretch_mod = 0.0f;
+
+float lfo_depth = 1.0f;
+float lfo_destination = 1.0f;
+
+// The LFO for the current block, one value per sample
+float lfo_buffer[max_block_size];
+
+// LFO depth on the output filter in semitones, and on the delay in samples
+float lpf_mod_depth = 0.0f;
+float delay_mod_depth = 0.0f;
+
+// The modulated delay time stays inside the delay knob's range
+float delay_min = 1.0f;
+float delay_max = max_delay_samples;
+
+// The output filter gets a new cutoff this often while the LFO modulates it
+constexpr size_t lfo_cutoff_interval = 16;
+
+std::atomic<ParameterPin> mod_targets[3] = {ParameterPin::LPF_NOTE, ParameterPin::DELAY, ParameterPin::FREEZE_SIZE};
+
+// Renders the LFO for the next block and sets its depth on each target, returns the LFO value at the end of the block.
+// When the output filter cutoff or the delay time is a target, it reads lfo_buffer while processing. Other targets,
+// like the freeze size that only changes between grains, are modulated through their parameter once per block.
+float apply_lfo(size_t size) {
+    
+    lfo.process_block(lfo_buffer, size);
+    float lfo_value = lfo_buffer[size - 1];
+    
+    // Split modulator between sources when the knob is inbetween positions
+    int first_target = lfo_destination;
+    int second_target = first_target == 2 ? 0 : lfo_destination + 1;
+    
+    float diff = first_target == 2 ? 1.0f : lfo_destination - first_target;
+    
+    // Depth per target, as a fraction of the target knob's range
+    float depths[3] = {0.0f, 0.0f, 0.0f};
+    depths[first_target] = abs(lfo_depth) * (1.0f - diff) * 0.5f;
+    depths[second_target] = lfo_depth * diff * 0.5f;
+    
+    float lpf_min, lpf_max;
+    SculptParameters::get_range(ParameterPin::LPF_NOTE, lpf_min, lpf_max);
+    SculptParameters::get_range(ParameterPin::DELAY, delay_min, delay_max);
+    
+    lpf_mod_depth = 0.0f;
+    delay_mod_depth = 0.0f;
+    
+    for(int i = ParameterPin::MIX; i <= ParameterPin::LFO_DEST; i++) {
+        auto pin = static_cast<ParameterPin>(i);
+        
+        // Summed over the slots that point at this parameter
+        float depth = 0.0f;
+        for(int slot = 0; slot < 3; slot++) {
+            if(mod_targets[slot] == pin) depth += depths[slot];
+        }
+        
+        // The output filter and delay apply their depth per sample, every other target through its parameter
+        if(pin == ParameterPin::LPF_NOTE) {
+            lpf_mod_depth = depth * (lpf_max - lpf_min);
+            depth = 0.0f;
+        }
+        else if(pin == ParameterPin::DELAY) {
+            delay_mod_depth = depth * (delay_max - delay_min);
+            depth = 0.0f;
+        }
+        
+        SculptParameters::apply_modulation(pin, lfo_value * depth);
+    }
+    
+    return lfo_value;
+}
+
+float noise_mix = 0.5f;
+float input_gain = 1.0f;
+float feedback = 0.0f;
+
+float delay_samples = 1.0f;
+float lpf_cutoff = 18000.0f;
+float lpf_resonance = 0.6f;
+
+// Reads all parameters, call set_shift and set_freeze with the switch states first.
+// Parameters are read every block to keep their smoothing running, but only changed values are passed on.
+void update_parameters() {
+    
+    float value;
+    
+    noise_mix = SculptParameters::get_value(MIX);
+    
+    if(SculptParameters::changed(LPF_Q, value)) {
+        lpf_resonance = value;
+        filt.SetRes(lpf_resonance);
+    }
+    if(SculptParameters::changed(LPF_NOTE, value)) lpf_cutoff = mtof(value);
+    
+    if(SculptParameters::changed(Q, value)) voice_handler.set_q(value);
+    if(SculptParameters::changed(SHAPE, value)) voice_handler.set_shape(value);
+    if(SculptParameters::changed(OCTAVER, value)) voice_handler.set_octave(value);
+    
+    if(SculptParameters::changed(ATTACK, value)) voice_handler.set_attack(value);
+    if(SculptParameters::changed(DECAY, value)) voice_handler.set_decay(value);
+    if(SculptParameters::changed(SUSTAIN, value)) voice_handler.set_sustain(value);
+    if(SculptParameters::changed(RELEASE, value)) voice_handler.set_release(value);
+    
+    input_gain = SculptParameters::get_value(GAIN);
+    feedback = SculptParameters::get_value(FEEDBACK);
+    delay_samples = SculptParameters::get_value(DELAY);
+    if(SculptParameters::changed(STRETCH, value)) voice_handler.set_stretch(value);
+    if(SculptParameters::changed(FREEZE_SIZE, value)) freeze.set_freeze_size(value);
+    
+    if(SculptParameters::changed(DRIVE, value)) {
+        drive_amt = value;
+        drive.set_drive(drive_amt);
+    }
+    
+    lfo.set_shape(SculptParameters::get_value(LFO_SHAPE));
+    lfo.set_frequency(SculptParameters::get_value(LFO_RATE));
+    lfo_depth = SculptParameters::get_value(LFO_DEPTH);
+    lfo_destination = SculptParameters::get_value(LFO_DEST);
+    
+    // Only rebuilds the voices that need it
+    voice_handler.update_filters();
+}
+
+
+// Switch case for Message Type.
+// Notes on MPE member channels carry their own bend, pressure and timbre, the master channel's apply to all notes.
+void handle_midi_message(MidiEvent m)
+{
+    int master = active_midi_channel - 1;
+    bool is_master = m.channel == master;
+    bool is_member = mpe.is_member(m.channel, master);
+    
+    if(!is_master && !is_member) return;
+    
+    int channel = is_member ? m.channel : decltype(voice_handler)::no_channel;
+    
+    switch(m.type)
+    {
+        case NoteOn:
+        {
+            NoteOnEvent p = m.AsNoteOn();
+            voice_handler.note_on(p.note, p.velocity, channel);
+            break;
+        }
+            
+        case NoteOff:
+        {
+            NoteOnEvent p = m.AsNoteOn();
+            voice_handler.note_off(p.note, p.velocity, channel);
+            break;
+        }
+            
+        case ControlChange:
+        {
+            ControlChangeEvent p = m.AsControlChange();
+            if(is_master && p.control_number == 4) { // sustain pedal
+                voice_handler.set_sustain_pedal(p.value != 0);
+            }
+            if(is_member && p.control_number == 74) { // timbre
+                voice_handler.set_channel_timbre(channel, (p.value - 64) * (1.0f / 64.0f));
+            }
+            if(mpe.control_change(m.channel, master, p.control_number, p.value)) {
+                // The MPE configuration message, notes start over in the new zone
+                voice_handler.free_voices();
+                voice_handler.reset_expression();
+            }
+            break;
+        }
+        case PitchBend:
+        {
+            PitchBendEvent p = m.AsPitchBend();
+            
+            float range = is_member ? mpe.member_bend_range : mpe.master_bend_range; // range in semitones
+            float bend = p.value * (1.0f / 8192.0f) * range;
+            
+            if(is_member) voice_handler.set_channel_bend(channel, bend);
+            else voice_handler.set_bend(bend);
+            break;
+        }
+        case ChannelPressure:
+        {
+            if(is_member) voice_handler.set_channel_pressure(channel, m.AsChannelPressure().pressure * (1.0f / 127.0f));
+            break;
+        }
+        default: break;
+    }
+}
+
+// A channel message and the sample time to play it at. Only the bytes handle_midi_message reads are kept,
+// a full MidiEvent would carry its SysEx buffer through the queue.
+struct ScheduledMidiEvent
+{
+    uint32_t time;
+    uint8_t type;
+    uint8_t channel;
+    uint8_t data[2];
+    
+    MidiEvent to_event() const
+    {
+        MidiEvent event;
+        event.type = static_cast<MidiMessageType>(type);
+        event.channel = channel;
+        event.data[0] = data[0];
+        event.data[1] = data[1];
+        return event;
+    }
+};
+
+// MIDI parsed outside the audio callback, oldest first
+EventQueue<ScheduledMidiEvent, 128> midi_queue;
+
+// Queues an event for the audio callback to play at the given sample time. System and SysEx messages are
+// left out, the audio callback ignores them and the settings are read from them in the main loop.
+// Returns false when the queue is full.
+bool queue_midi_event(const MidiEvent& event, uint32_t time)
+{
+    if(event.type == SystemCommon || event.type == SystemRealTime) return true;
+    
+    return midi_queue.push({time, static_cast<uint8_t>(event.type), static_cast<uint8_t>(event.channel), {event.data[0], event.data[1]}});
+}
+
+// Sample time of the first sample of the next block
+uint32_t sample_time = 0;
+
+// Renders the voices for the next block, playing the queued MIDI events that are due in it at their sample position:
+// the voices are rendered up to an event, the event is applied and rendering continues from there.
+// Events that are late play at the start of the block.
+void render_voices(const float* in, float* out, size_t size)
+{
+    size_t position = 0;
+    
+    for(auto* queued = midi_queue.peek(); queued; queued = midi_queue.peek()) {
+        // Compared as a difference, so the sample clock can wrap
+        int32_t offset = static_cast<int32_t>(queued->time - sample_time);
+        if(offset >= static_cast<int32_t>(size)) break;
+        
+        size_t event_position = std::max(offset, 0);
+        
+        if(event_position > position) {
+            voice_handler.process_block(in + position, out + position, event_position - position);
+            position = event_position;
+        }
+        
+        profiler.begin_span();
+        
+        handle_midi_message(queued->to_event());
+        midi_queue.pop();
+        
+        // A new note or bend needs its coefficients before the rest of the block
+        voice_handler.update_filters();
+        
+        profiler.end_span();
+    }
+    
+    voice_handler.process_block(in + position, out + position, size - position);
+}
+
+// Svf has no reset, so clear its state by initialising it again
+void reset_output_filter()
+{
+    filt.Init(sample_rate);
+    filt.SetFreq(std::clamp(cutoff_smoother.get_value(), 20.0f, static_cast<float>(max_delay_samples)));
+    filt.SetRes(lpf_resonance);
+    filt.SetDrive(0.8f);
+}
+
+void init_engine()
+{
+    enable_flush_to_zero();
+    
+    noise.init();
+    
+    delay_smoother.init(0.0005f, 0.0f);
+    cutoff_smoother.init(0.0005f, 0.0f);
+    
+    filt.Init(sample_rate);
+    filt.SetFreq(6000.f);
+    filt.SetRes(lpf_resonance);
+    filt.SetDrive(0.8f);
+    
+    freeze.init(freeze_buffer);
+    delay.Init();
+    drive.init(sample_rate);
+    drive.set_oversampling(drive_oversampling);
+    
+    voice_handler.init(sample_rate);
+    
+    profiler.init(sample_rate, max_block_size);
+}
+
+// Runs the full signal chain over one block, one stage at a time
+void process_audio(const float* in, float* out, size_t size)
+{
+    noise.process_block(input_buffer, size, 1.0f - noise_mix);
+    
+    for(size_t i = 0; i < size; i++)
+    {
+        input_buffer[i] += in[i] * input_gain * noise_mix;
+    }
+    
+    freeze.process_block(input_buffer, input_buffer, size);
+    
+    profiler.lap(StageInput);
+    
+    render_voices(input_buffer, synth_buffer, size);
+    
+    bool silent = SilenceDetector::is_silent(synth_buffer, size);
+    
+    profiler.lap(StageVoices);
+    profiler.lap_spans(StageMidi);
+    
+    // Effect stages are skipped while their input is silent and their tail has died away,
+    // a skipped stage leaves the (silent) buffer as it is
+    if(!delay_silence.is_asleep(silent))
+    {
+        float delay_times[max_block_size];
+        float delayed[max_block_size];
+        
+        delay_smoother.process(delay_samples, size);
+        delay_smoother.ramp(delay_times, size);
+        
+        float shortest_delay = max_delay_samples;
+        
+        for(size_t i = 0; i < size; i++)
+        {
+            delay_times[i] = std::clamp(delay_times[i] + lfo_buffer[i] * delay_mod_depth, delay_min, delay_max);
+            shortest_delay = std::min(shortest_delay, delay_times[i]);
+        }
+        
+        // A block read can't see what the same block writes, so delays shorter than the block are done in shorter chunks
+        size_t chunk = std::max<size_t>(1, static_cast<size_t>(shortest_delay) - 1);
+        
+        for(size_t start = 0; start < size; start += chunk)
+        {
+            size_t length = std::min(chunk, size - start);
+            
+            delay.ReadHermiteBlock(delay_times + start, delayed + start, length);
+            
+            for(size_t i = start; i < start + length; i++)
+            {
+                synth_buffer[i] += delayed[i];
+                delayed[i] = synth_buffer[i] * feedback;
+            }
+            
+            delay.WriteBlock(delayed + start, length);
+        }
+        
+        // Echoes can be a full delay time apart
+        bool input_silent = silent;
+        silent = SilenceDetector::is_silent(synth_buffer, size);
+        
+        if(delay_silence.update(input_silent && silent, size, static_cast<size_t>(delay_smoother.get_value() + std::abs(delay_mod_depth)) + size)) {
+            // Clearing all of it at once would take longer than the block it happens in
+            delay_samples_to_clear = delay.kCapacity;
+        }
+    }
+    else {
+        delay_smoother.snap(delay_samples);
+        
+        size_t clear = std::min(size, delay_samples_to_clear);
+        delay.WriteZeros(clear);
+        delay_samples_to_clear -= clear;
+    }
+    
+    profiler.lap(StageDelay);
+    
+    // Apply distortion
+    if(!drive_silence.is_asleep(silent))
+    {
+        drive.process_block(synth_buffer, size);
+        
+        // Give the level followers time to settle before resetting them
+        bool input_silent = silent;
+        silent = SilenceDetector::is_silent(synth_buffer, size);
+        
+        if(drive_silence.update(input_silent && silent, size, static_cast<size_t>(sample_rate * 0.1f))) {
+            drive.reset();
+        }
+    }
+    
+    profiler.lap(StageDrive);
+    
+    if(!output_silence.is_asleep(silent))
+    {
+        // The filter interpolates its coefficients between cutoffs, instead of recomputing them every sample,
+        // and only computes the lowpass output. While the LFO modulates it the cutoff is updated every lfo_cutoff_interval samples.
+        float cutoffs[max_block_size];
+        cutoff_smoother.process(lpf_cutoff, size);
+        cutoff_smoother.ramp(cutoffs, size);
+        
+        size_t interval = lpf_mod_depth != 0.0f ? lfo_cutoff_interval : size;
+        
+        for(size_t start = 0; start < size; start += interval)
+        {
+            size_t length = std::min(interval, size - start);
+            size_t end = start + length - 1;
+            
+            float cutoff = cutoffs[end] * exp2f(lfo_buffer[end] * lpf_mod_depth * (1.0f / 12.0f));
+            filt.ProcessBlock<Svf::OUT_LOW>(synth_buffer + start, out + start, length, std::clamp(cutoff, 20.0f, static_cast<float>(max_delay_samples)));
+        }
+        
+        for(size_t i = 0; i < size; i++) out[i] *= 1.4f;
+        
+        // A ringing filter can't come back without input, so one silent block is enough
+        if(output_silence.update(silent && SilenceDetector::is_silent(out, size), size, size)) {
+            reset_output_filter();
+        }
+    }
+    else {
+        cutoff_smoother.snap(lpf_cutoff);
+        
+        for(size_t i = 0; i < size; i++)
+        {
+            out[i] = 0.0f;
+        }
+    }
+    
+    profiler.lap(StageOutputFilter);
+    
+    sample_time += size;
+}
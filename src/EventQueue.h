@@ -0,0 +1,49 @@
+#pragma once
+
+// Wait-free queue from one producer context to one consumer context, used to hand MIDI from the main loop
+// to the audio callback. Neither side ever blocks or disables interrupts: each index is only written by
+// its own side, and published with release/acquire ordering so the other side sees complete items.
+
+#include <atomic>
+#include <stddef.h>
+
+template <typename T, size_t capacity>
+struct EventQueue
+{
+    static_assert((capacity & (capacity - 1)) == 0, "The capacity has to be a power of two");
+
+    // Producer side. Returns false and drops the item if the queue is full.
+    bool push(const T& item)
+    {
+        size_t write = write_index.load(std::memory_order_relaxed);
+        if(write - read_index.load(std::memory_order_acquire) == capacity) return false;
+
+        items[write & mask] = item;
+        write_index.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns the oldest item without removing it, or nullptr if the queue is empty.
+    const T* peek() const
+    {
+        size_t read = read_index.load(std::memory_order_relaxed);
+        if(read == write_index.load(std::memory_order_acquire)) return nullptr;
+
+        return &items[read & mask];
+    }
+
+    // Consumer side. Removes the item returned by peek.
+    void pop()
+    {
+        read_index.store(read_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t mask = capacity - 1;
+
+    T items[capacity];
+
+    // Free-running counters, their difference is the number of queued items
+    std::atomic<size_t> write_index{0};
+    std::atomic<size_t> read_index{0};
+};
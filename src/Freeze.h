@@ -1,81 +1,160 @@
 #pragma once
 
-template<int max_length>
+// Input freeze. While not frozen the input is recorded into a ring buffer. Freezing loops the last
+// freeze_len samples before the switch was pressed.
+// The loop is played as a chain of overlapping grains. Each grain starts a crossfade length before the loop
+// and overlaps the next grain by that much, so every seam fades from the end of the loop into the audio that
+// originally led into its start. Switching freeze on or off crossfades between live and frozen audio.
+// The ring is large, so it should live in SDRAM: pass it to init() after the SDRAM is set up.
+
+template<int capture_length>
 struct Freeze
 {
-    Freeze() {
-        max_sample_len = max_length;
-        read_head = 0;
+    static_assert((capture_length & (capture_length - 1)) == 0, "The capture length has to be a power of two");
+
+    static constexpr int max_grains = 2; // A new grain only overlaps the end of the previous one
+    static constexpr int max_fade_len = 480; // 15 ms at 32 kHz
+    static constexpr int min_freeze_len = 64;
+    static constexpr int max_freeze_len = capture_length - max_fade_len;
+    static constexpr float switch_fade_step = 1.0f / 256.0f;
+
+    void init(float* capture_buffer) {
+        buffer = capture_buffer;
+
+        for(int i = 0; i < capture_length; i++) buffer[i] = 0.0f;
+
         write_head = 0;
-        prev_input = 0;
-        sample_loaded = false;
-        set_freeze_size(std::min(512, max_length));
+        frozen_mix = 0.0f;
+        freeze = false;
+
+        for(auto& grain : grains) grain.remaining = 0;
+
+        set_freeze_size(512);
     }
-    
-    
+
     void set_freeze(bool frozen) {
-        if(frozen != freeze) {
-            freeze = frozen;
-            sample_loaded = false;
-            write_en = false;
-            sample_req = true;
+        if(frozen == freeze) return;
+
+        freeze = frozen;
+
+        if(freeze) {
+            loop_end = write_head;
+
+            // Start inside the first grain, the crossfade from the live input covers its fade in
+            for(auto& grain : grains) grain.remaining = 0;
+            start_grain(grains[0]);
+
+            int fade = grains[0].fade;
+            grains[0].position += fade;
+            grains[0].elapsed = fade;
+            grains[0].remaining -= fade;
+            next_grain = grains[0].remaining - fade;
         }
     }
-    
+
+    // Takes effect at the next grain, so resizing a frozen loop doesn't click
     void set_freeze_size(int grain_samples) {
-        freeze_len = std::min<int>(grain_samples, max_sample_len);
+        freeze_len = std::clamp(grain_samples, min_freeze_len, max_freeze_len);
     }
-    
-    float process(float input)
+
+    // Works in place
+    void process_block(const float* input, float* output, size_t size)
     {
-        float output = 0;
-        
-        if(!freeze) {
-            prev_input = input;
-            return input;
+        // Nothing frozen and not fading out of a freeze: record and pass the input through
+        if(!freeze && frozen_mix == 0.0f) {
+            for(size_t i = 0; i < size; i++) {
+                buffer[write_head] = input[i];
+                write_head = (write_head + 1) & mask;
+                output[i] = input[i];
+            }
+            return;
         }
 
-        if (sample_req) {
-            // only begin capture on zero cross
-            if ((input < 0.0f && prev_input >= 0.0f) ||
-                (input >= 0.0f && prev_input < 0.0f)) {
-                write_en = true;
-                write_head = 0;
-                read_head = 0;
-                sample_req = false;
-                
-            } else {
-                prev_input = input;
+        for(size_t i = 0; i < size; i++) {
+            float live = input[i];
+
+            // Recording resumes as soon as freeze is off, the loop keeps playing until it has faded out
+            if(!freeze) {
+                buffer[write_head] = live;
+                write_head = (write_head + 1) & mask;
+            }
+
+            // The next grain starts when the current one has a fade length left
+            if(next_grain <= 0) {
+                for(auto& grain : grains) {
+                    if(grain.remaining <= 0) {
+                        start_grain(grain);
+                        next_grain = grain.length - grain.fade;
+                        break;
+                    }
+                }
+            }
+            next_grain--;
+
+            float frozen = 0.0f;
+            for(auto& grain : grains) {
+                if(grain.remaining > 0) frozen += process_grain(grain);
             }
+
+            frozen_mix = freeze ? std::min(frozen_mix + switch_fade_step, 1.0f) : std::max(frozen_mix - switch_fade_step, 0.0f);
+
+            output[i] = live + frozen_mix * (frozen - live);
         }
-        
-        if (write_en) {
-            sample_bank[write_head++] = input;
-            if (write_head >= freeze_len)     sample_loaded = true;
-            if (write_head >= max_sample_len) write_en = false;
+    }
+
+private:
+
+    struct Grain
+    {
+        int position;
+        int elapsed;
+        int remaining;
+        int length;
+        int fade;
+    };
+
+    void start_grain(Grain& grain) {
+        grain.fade = std::min(freeze_len / 2, max_fade_len);
+        grain.length = freeze_len + grain.fade;
+        grain.position = loop_end - freeze_len - grain.fade;
+        grain.elapsed = 0;
+        grain.remaining = grain.length;
+    }
+
+    float process_grain(Grain& grain) {
+        float gain = 1.0f;
+
+        if(grain.elapsed < grain.fade) {
+            gain = fade_curve(grain.elapsed / static_cast<float>(grain.fade));
         }
-        
-        if (sample_loaded) {
-            if (read_head >= freeze_len) {
-                read_head -= freeze_len;
-            }
-            
-            read_head++;
-            output = sample_bank[read_head];
+        else if(grain.remaining <= grain.fade) {
+            gain = fade_curve(grain.remaining / static_cast<float>(grain.fade));
         }
-        
-        return output;
+
+        float sample = buffer[grain.position & mask] * gain;
+
+        grain.position++;
+        grain.elapsed++;
+        grain.remaining--;
+
+        return sample;
     }
 
-    float sample_bank[max_length];
-    int max_sample_len;
-    int write_head;
-    int read_head;
-    int freeze_len;
-    float prev_input;
-    
-    bool sample_loaded;
-    bool write_en;
-    bool sample_req;
-    bool freeze;
+    // Smoothstep, a fade in and the matching fade out always add up to one
+    static float fade_curve(float x) {
+        return x * x * (3.0f - 2.0f * x);
+    }
+
+    static constexpr int mask = capture_length - 1;
+
+    float* buffer = nullptr;
+    Grain grains[max_grains];
+
+    int write_head = 0;
+    int loop_end = 0;
+    int next_grain = 0;
+    int freeze_len = 512;
+    float frozen_mix = 0.0f;
+
+    bool freeze = false;
 };
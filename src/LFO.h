@@ -3,36 +3,81 @@
 
 #pragma once
 
+// Renders a block of LFO values at a time, one per sample.
+// The shape knob morphs sine -> square -> saw -> triangle. The smooth shapes (sine and triangle) are mixed
+// into a wavetable whenever the shape changes, square and saw are computed directly with polyBLEP
+// corrections at their steps. The per-sample loop has no branches or calls.
+
 class LFO {
 
 public:
-    
-    LFO(float sr, int block_size) {
-        rate = sr / block_size;
+
+    LFO(float sr) {
+        sample_period = 1.0f / sr;
+        set_shape(0.0f);
     }
 
-    // Move phase value to the next sample
-    float tick() {
-        
-        if(frequency != 0)
+    // Fills out with the next size samples
+    void process_block(float* out, size_t size) {
+
+        float increment = frequency * sample_period;
+        // The polyBLEP corrections span one sample either side of a step
+        float inverse_dt = 1.0f / std::max(increment, 1e-9f);
+
+        // Locals, so the compiler doesn't have to reload them after every write to out
+        float saw_step = -(saw_weight + square_weight);
+        float square_step = square_weight;
+        float saw_level = saw_weight;
+        float square_level = square_weight;
+
+        // Each sample's phase is computed from the block's start, so the samples don't depend on each other
+        float start_phase = phase;
+
+        for(size_t i = 0; i < size; i++)
         {
-            phase += frequency / rate;
-            if(phase >= 1) phase = phase - 1;
+            float sample_phase = start_phase + increment * static_cast<int>(i + 1);
+            sample_phase -= static_cast<int>(sample_phase);
+
+            float position = sample_phase * table_size;
+            int index = static_cast<int>(position);
+            float fraction = position - index;
+            float smooth = shape_table[index] + fraction * (shape_table[index + 1] - shape_table[index]);
+
+            float saw = sample_phase * 2.0f - 1.0f;
+            float square = sample_phase >= 0.5f ? 1.0f : -1.0f;
+
+            // Saw and square both step down at phase 0, the square steps up again at 0.5
+            float half_phase = sample_phase + 0.5f;
+            half_phase -= static_cast<int>(half_phase);
+            float steps = saw_step * poly_blep(sample_phase, inverse_dt) + square_step * poly_blep(half_phase, inverse_dt);
+
+            out[i] = smooth + saw_level * saw + square_level * square + steps;
         }
-        
-        // Mix between shapes
-        int first_shape = shape;
-        int second_shape = shape == 3 ? 3 : shape + 1;
-        float mix = shape - first_shape;
-        
-        float first_value = (this->*shapePointers[first_shape])();
-        float second_value = (this->*shapePointers[second_shape])();
-        
-        return (first_value + mix * (second_value - first_value));
+
+        phase = start_phase + increment * static_cast<int>(size);
+        phase -= static_cast<int>(phase);
     }
 
     void set_shape(float shp) {
+        if(shp == shape) return;
         shape = shp;
+
+        // Mix between shapes
+        int first_shape = shape;
+        int second_shape = shape == 3 ? 3 : first_shape + 1;
+        float mix = shape - first_shape;
+
+        float weights[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        weights[first_shape] += 1.0f - mix;
+        weights[second_shape] += mix;
+
+        square_weight = weights[1];
+        saw_weight = weights[2];
+
+        for(int i = 0; i <= table_size; i++) {
+            float table_phase = static_cast<float>(i) / table_size;
+            shape_table[i] = weights[0] * cosf(table_phase * twoPI) + weights[3] * triangle(table_phase);
+        }
     }
 
 
@@ -41,40 +86,34 @@ public:
     }
 
 private:
-    float shape = 0;
+
+    static float triangle(float phase) {
+        float sample = -1.0f + (2.0f * phase);
+        sample = 0.9f * (fabsf(sample) - 0.5f);
+        return sample;
+    }
+
+    // Residual of a band-limited step of height -2 at phase 0, zero more than a sample away from it.
+    // The usual piecewise polynomials, written with max so the loop stays branch-free.
+    static float poly_blep(float t, float inverse_dt) {
+        float after = std::max(1.0f - t * inverse_dt, 0.0f);
+        float before = std::max(1.0f - (1.0f - t) * inverse_dt, 0.0f);
+        return before * before - after * after;
+    }
+
+    // Entries per cycle, the triangle's corners fall on table points so interpolation is exact for it
+    static constexpr int table_size = 256;
+
+    float shape = -1.0f;
 
     float frequency = 1.0f;
     float phase = 0.0f;
     float twoPI = 2.0f * M_PI;
 
-    // fast cosine approximation
-    float sine() {
-        auto x = phase * twoPI;
-        auto x2 = x * x;
-        auto numerator = -(-39251520 + x2 * (18471600 + x2 * (-1075032 + 14615 * x2)));
-        auto denominator = 39251520 + x2 * (1154160 + x2 * (16632 + x2 * 127));
-        return numerator / denominator;
-    }
-    
-    float sawtooth() {
-        return (phase * 2.0f) - 1.0f;
-    }
-    
-    float square() {
-        float sample;
-        if(phase >= 0.5) sample = 1.0f; // 1 and -1 makes it significantly louder than the sine and saw
-        else sample = -1.0f;
-        return sample;
-    }
-    
-    float triangle() {
-        float sample = -1.0 + (2.0 * phase);
-        sample = 0.9 * (fabs(sample) - 0.5);
-        return sample;
-    }
+    float sample_period;
 
-    float rate;
-    //Pointers to the waveshape generators
-    float (LFO::*shapePointers[4])() = {&LFO::sine, &LFO::square, &LFO::sawtooth, &LFO::triangle};
+    float square_weight = 0.0f;
+    float saw_weight = 0.0f;
+    float shape_table[table_size + 1];
 
 };
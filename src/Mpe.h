@@ -0,0 +1,85 @@
+#pragma once
+
+// MPE (MIDI Polyphonic Expression) zone. The zone's master channel is the MIDI channel from the settings,
+// and its member channels are the ones after it, or the ones before it when the master is channel 16
+// (the MPE upper zone). A controller plays each note on a member channel of its own, so the pitch bend,
+// pressure and CC74 on that channel only move that one note. Messages on the master channel apply to
+// every note.
+// The zone is set from the settings app, or by the controller with the MPE configuration message:
+// RPN 6 on the master channel. RPN 0 sets the pitch bend range of the master or the member channels.
+
+#include <atomic>
+#include <stdint.h>
+
+struct MpeZone
+{
+    static constexpr int num_channels = 16;
+    static constexpr int max_member_channels = num_channels - 1;
+
+    // MPE is off at 0, then only the master channel plays. Atomic because SysEx sets it from the main loop,
+    // while the MPE configuration message sets it in the audio callback.
+    std::atomic<int> member_channels{0};
+
+    // Semitones for a full bend. Notes on the member channels use the MPE default.
+    float master_bend_range = 12.0f;
+    float member_bend_range = 48.0f;
+
+    MpeZone()
+    {
+        for(int i = 0; i < num_channels; i++) rpn_msb[i] = rpn_lsb[i] = rpn_none;
+    }
+
+    void set_member_channels(int channels)
+    {
+        member_channels = channels < 0 ? 0 : (channels > max_member_channels ? max_member_channels : channels);
+    }
+
+    // Channels count from 0, like MidiEvent::channel
+    bool is_member(int channel, int master) const
+    {
+        int distance = master == num_channels - 1 ? master - channel : channel - master;
+        return distance >= 1 && distance <= member_channels;
+    }
+
+    // Follows the RPN messages on the zone's channels. Returns true for the MPE configuration message,
+    // after which the notes playing should start over.
+    bool control_change(int channel, int master, uint8_t control, uint8_t value)
+    {
+        switch(control)
+        {
+            case 101: rpn_msb[channel] = value; break;
+            case 100: rpn_lsb[channel] = value; break;
+            case 6: return data_entry(channel, master, value);
+            default: break;
+        }
+        return false;
+    }
+
+private:
+    static constexpr uint8_t rpn_none = 127;
+
+    bool data_entry(int channel, int master, uint8_t value)
+    {
+        if(rpn_msb[channel] != 0) return false;
+
+        if(rpn_lsb[channel] == 0) {
+            // Pitch bend sensitivity, in semitones
+            if(channel == master) master_bend_range = value;
+            else member_bend_range = value;
+        }
+
+        if(rpn_lsb[channel] == 6 && channel == master) {
+            set_member_channels(value);
+
+            // The zone starts over with the default member bend range
+            member_bend_range = 48.0f;
+            return true;
+        }
+
+        return false;
+    }
+
+    // The RPN that data entry goes to, selected per channel
+    uint8_t rpn_msb[num_channels];
+    uint8_t rpn_lsb[num_channels];
+};
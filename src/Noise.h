@@ -0,0 +1,92 @@
+#pragma once
+
+// Noise source for the resonator excitation, filled a block at a time.
+// xorshift32 generators, turned into floats by putting the top 23 random bits into the mantissa of a float
+// in [1, 2): no division or int to float conversion per sample. Blocks are filled by four interleaved
+// generators, so consecutive samples don't wait on each other and the loop vectorises.
+
+#include <stdint.h>
+#include <string.h>
+
+struct NoiseGenerator
+{
+    void init(uint32_t seed = 0x9E3779B9u)
+    {
+        // Spread the seed over the lanes, none of them may be zero or xorshift gets stuck there
+        for(int lane = 0; lane < lanes; lane++) {
+            seed = seed * 1664525u + 1013904223u;
+            state[lane] = seed != 0 ? seed : 1;
+        }
+
+        pink_state[0] = pink_state[1] = pink_state[2] = 0.0f;
+    }
+
+    // Uniform in [-1, 1), from the first lane
+    inline float white()
+    {
+        return to_float(step(state[0]));
+    }
+
+    // Fills out with uniform white noise times gain
+    void process_block(float* out, size_t size, float gain = 1.0f)
+    {
+        uint32_t x[lanes];
+        for(int lane = 0; lane < lanes; lane++) x[lane] = state[lane];
+
+        size_t i = 0;
+
+        for(; i + lanes <= size; i += lanes) {
+            for(int lane = 0; lane < lanes; lane++) out[i + lane] = to_float(step(x[lane])) * gain;
+        }
+
+        // Fewer than lanes samples left
+        for(int lane = 0; lane < lanes && i < size; lane++, i++) out[i] = to_float(step(x[lane])) * gain;
+
+        for(int lane = 0; lane < lanes; lane++) state[lane] = x[lane];
+    }
+
+    // Fills out with pink noise (-3 dB per octave) times gain, at about the level of the white noise.
+    // Paul Kellet's three pole approximation of the -3 dB per octave slope.
+    void process_block_pink(float* out, size_t size, float gain = 1.0f)
+    {
+        float b0 = pink_state[0], b1 = pink_state[1], b2 = pink_state[2];
+        float scale = gain * pink_level;
+
+        for(size_t i = 0; i < size; i++) {
+            float w = white();
+            b0 = 0.99765f * b0 + w * 0.0990460f;
+            b1 = 0.96300f * b1 + w * 0.2965164f;
+            b2 = 0.57000f * b2 + w * 1.0526913f;
+            out[i] = (b0 + b1 + b2 + w * 0.1848f) * scale;
+        }
+
+        pink_state[0] = b0;
+        pink_state[1] = b1;
+        pink_state[2] = b2;
+    }
+
+private:
+    static constexpr int lanes = 4;
+
+    // Brings the pink filter's output RMS down to the white noise's
+    static constexpr float pink_level = 0.335f;
+
+    static inline uint32_t step(uint32_t& x)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    static inline float to_float(uint32_t random)
+    {
+        uint32_t bits = 0x3F800000u | (random >> 9);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value * 2.0f - 3.0f;
+    }
+
+    uint32_t state[lanes] = {1, 2, 3, 4};
+    float pink_state[3] = {0.0f, 0.0f, 0.0f};
+};
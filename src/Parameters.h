@@ -52,19 +52,22 @@ using SingleParameter = std::tuple<ParameterPin, float, float, float, daisy::Par
 
 using ParameterInit = std::vector<SingleParameter>;
 
-static inline ParameterMode parameter_mode = TOUCH;
+// Set from SysEx in the main loop
+static inline std::atomic<ParameterMode> parameter_mode{TOUCH};
 
 struct SculptParameter
 {
 
-    SculptParameter(ParameterInit init){
+    // The ADC source only needs to provide GetPtr(channel), like daisy::AdcHandle
+    template <typename AdcSource>
+    SculptParameter(ParameterInit init, AdcSource& adc){
         
         // Get parameter pin, range, init and scaling
         auto [pin1, min1, max1, init1, scale1, deadzone1] = init[0];
         auto [pin2, min2, max2, init2, scale2, deadzone2] = init[1];
         
         // Initialise ADC
-        control.Init(sculpt.adc.GetPtr((int)pin1 - 15), sculpt.AudioSampleRate() / 256.0f);
+        control.Init(adc.GetPtr((int)pin1 - 15), sample_rate / block_size);
         control.SetCoeff (0.5f);
         
         
@@ -87,6 +90,9 @@ struct SculptParameter
         max[0] = max1;
         max[1] = max2;
         
+        change_threshold[0] = (max1 - min1) * relative_change_threshold;
+        change_threshold[1] = (max2 - min2) * relative_change_threshold;
+        
         deadzone[0] = deadzone1;
         deadzone[1] = deadzone2;
         
@@ -164,6 +170,17 @@ struct SculptParameter
     }
     
     
+    // Gets parameter value, and returns whether it moved far enough since it was last reported to be worth propagating
+    bool process_changed(bool wanted_shift, float& value) {
+        value = process(wanted_shift);
+        
+        // Also true for the first call, when the reported value is still NaN
+        if(abs(value - reported_value[wanted_shift]) <= change_threshold[wanted_shift]) return false;
+        
+        reported_value[wanted_shift] = value;
+        return true;
+    }
+    
     inline void set_fc(double Fc) {
         b1 = exp(-2.0 * M_PI * Fc);
         a0 = 1.0 - b1;
@@ -178,6 +195,9 @@ struct SculptParameter
         modulation_value[shift] = mod_value;
     }
     
+    inline float get_min(bool shift) const { return min[shift]; }
+    inline float get_max(bool shift) const { return max[shift]; }
+    
     inline float apply_deadzone(float value, bool shift) {
         
         if(deadzone[shift] < 0.0f) {
@@ -213,12 +233,17 @@ private:
     float min[2], max[2];
     
     float last_value[2];
-    double a0, b1, z1[2];
+    double a0, b1, z1[2] = {0.0, 0.0};
     
-    float modulation_value[2];
+    float modulation_value[2] = {0.0f, 0.0f};
     
     float deadzone_size = 0.03f;
     
+    // Changes below 1/4096th of the range (the ADC's effective resolution) are not reported
+    static constexpr float relative_change_threshold = 1.0f / 4096.0f;
+    float change_threshold[2];
+    float reported_value[2] = {NAN, NAN};
+    
 
     AnalogControl control;
 };
@@ -227,7 +252,8 @@ struct SculptParameters
 {
     static inline std::vector<SculptParameter> sculpt_parameters = std::vector<SculptParameter>();
     
-    static void init(bool shift) {
+    template <typename AdcSource>
+    static void init(bool shift, AdcSource& adc) {
         
         SculptParameter::shift = shift;
         
@@ -235,16 +261,16 @@ struct SculptParameters
         // Make sure the adc is initialised before calling this!
 
         sculpt_parameters = {
-            SculptParameter({{MIX, 0.0f, 1.0f, 0.5f, Linear, {}},            {GAIN, 1.0f, 4.0f, 0.5f, Linear, {}}}),
-            SculptParameter({{LPF_Q, 0.0f, 0.99f, 0.5f, Linear, {}},         {FEEDBACK, 0.0f, 0.99f, 0.0f, Linear, {}}}),
-            SculptParameter({{LPF_NOTE, 23.0f, 132.0f, 0.8f, Linear, {}},    {DELAY, 128.0f, (sample_rate / 2.0f), 0.1f, Linear, {}}}),
-            SculptParameter({{SHAPE, 0.0f, 3.0f, 0.75f, Linear, {}},         {STRETCH, 0.0f, 2.0f, 0.5f, Linear, 0.5f}}),
-            SculptParameter({{Q, 1.0f, 30.0f, 0.9f, ExpScale, {}},           {DRIVE, 0.1f, 1.0f, 0.0f, Linear, {}}}),
-            SculptParameter({{OCTAVER, -1.0f, 1.0f, 0.5f, Linear, 0.5f},   {FREEZE_SIZE, 64.0f, 8192.0f, 0.0f, ExpScale, {}}}),
-            SculptParameter({{ATTACK, 5.0f, 4000.0f, 0.02f, ExpScale, {}},   {LFO_SHAPE, 0.0f, 2.0f, 0.5f, Linear, {}}}),
-            SculptParameter({{DECAY, 5.0f, 4000.0f, 0.4f, ExpScale, {}},     {LFO_RATE, 0.5f, 20.0f, 0.2f, Linear, {}}}),
-            SculptParameter({{SUSTAIN, 0.0f, 1.0f, 0.3f, Linear, {}},        {LFO_DEPTH, -1.0f, 1.0f, 0.5f, Linear, 0.5f}}),
-            SculptParameter({{RELEASE, 5.0f, 4000.0f, 0.2f, ExpScale, {}},   {LFO_DEST, 0.0f, 2.0f, 0.5f, Linear, {}}})
+            SculptParameter({{MIX, 0.0f, 1.0f, 0.5f, Linear, {}},            {GAIN, 1.0f, 4.0f, 0.5f, Linear, {}}}, adc),
+            SculptParameter({{LPF_Q, 0.0f, 0.99f, 0.5f, Linear, {}},         {FEEDBACK, 0.0f, 0.99f, 0.0f, Linear, {}}}, adc),
+            SculptParameter({{LPF_NOTE, 23.0f, 132.0f, 0.8f, Linear, {}},    {DELAY, 128.0f, (sample_rate / 2.0f), 0.1f, Linear, {}}}, adc),
+            SculptParameter({{SHAPE, 0.0f, 3.0f, 0.75f, Linear, {}},         {STRETCH, 0.0f, 2.0f, 0.5f, Linear, 0.5f}}, adc),
+            SculptParameter({{Q, 1.0f, 30.0f, 0.9f, ExpScale, {}},           {DRIVE, 0.1f, 1.0f, 0.0f, Linear, {}}}, adc),
+            SculptParameter({{OCTAVER, -1.0f, 1.0f, 0.5f, Linear, 0.5f},   {FREEZE_SIZE, 64.0f, 64000.0f, 0.0f, ExpScale, {}}}, adc),
+            SculptParameter({{ATTACK, 5.0f, 4000.0f, 0.02f, ExpScale, {}},   {LFO_SHAPE, 0.0f, 2.0f, 0.5f, Linear, {}}}, adc),
+            SculptParameter({{DECAY, 5.0f, 4000.0f, 0.4f, ExpScale, {}},     {LFO_RATE, 0.5f, 20.0f, 0.2f, Linear, {}}}, adc),
+            SculptParameter({{SUSTAIN, 0.0f, 1.0f, 0.3f, Linear, {}},        {LFO_DEPTH, -1.0f, 1.0f, 0.5f, Linear, 0.5f}}, adc),
+            SculptParameter({{RELEASE, 5.0f, 4000.0f, 0.2f, ExpScale, {}},   {LFO_DEST, 0.0f, 2.0f, 0.5f, Linear, {}}}, adc)
         };
         
     }
@@ -275,6 +301,14 @@ struct SculptParameters
         }
     }
     
+    // Output range of a parameter, modulation of linear parameters can be applied in these units
+    static void get_range(ParameterPin pin, float& min, float& max) {
+        bool shift = pin >= 25;
+        auto& param = sculpt_parameters[(int)pin - (shift ? 25 : 15)];
+        min = param.get_min(shift);
+        max = param.get_max(shift);
+    }
+    
     static float get_value(ParameterPin pin) {
         
         if(pin >= 25)  {
@@ -284,5 +318,16 @@ struct SculptParameters
             return sculpt_parameters[(int)pin - 15].process(false);
         }
     }
+    
+    // Like get_value, but only returns true if the value changed since the last call
+    static bool changed(ParameterPin pin, float& value) {
+        
+        if(pin >= 25)  {
+            return sculpt_parameters[(int)pin - 25].process_changed(true, value);
+        }
+        else {
+            return sculpt_parameters[(int)pin - 15].process_changed(false, value);
+        }
+    }
 };
 
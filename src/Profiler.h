@@ -0,0 +1,170 @@
+#pragma once
+
+// Per-stage timing of the audio callback. Each stage is timed once per block and accumulated into
+// min/avg/max, which the Seed reports over SysEx and the offline renderer prints.
+// Work that is interleaved with a stage, like the MIDI events played between voice renders, is timed
+// as a span: it's left out of the lap it happens in and added to a stage of its own once per block.
+// On the Seed this samples the system tick timer like daisy::CpuLoadMeter, on host builds it uses std::chrono.
+
+#include <atomic>
+#include <stdint.h>
+
+#ifdef RECIPHER_HOST
+#include <chrono>
+#endif
+
+enum ProfileStage
+{
+    StageMidi,
+    StageLfo,
+    StageParameters,
+    StageInput,
+    StageVoices,
+    StageDelay,
+    StageDrive,
+    StageOutputFilter,
+    StageTotal,
+    NumProfileStages
+};
+
+static constexpr const char* profile_stage_names[NumProfileStages] = {
+    "MIDI", "LFO", "Parameters", "Input", "Voices", "Delay", "Drive", "Output filter", "Total"
+};
+
+struct StageStats
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t count;
+
+    float get_avg() const { return count ? static_cast<float>(total) / count : 0.0f; }
+};
+
+struct Profiler
+{
+    void init(float sample_rate, size_t block_size)
+    {
+        ticks_per_block = get_tick_frequency() * (block_size / sample_rate);
+        reset();
+    }
+
+    void reset()
+    {
+        for(auto& s : stats) s = {UINT32_MAX, 0, 0, 0};
+    }
+
+    // Resets the stats at the start of the next block, for callers outside the audio callback.
+    // The stats up to then can be read with get_reset_stats() once that happened.
+    void request_reset()
+    {
+        reset_requested.store(true, std::memory_order_release);
+    }
+
+    // Copies the stats as they were at the last requested reset. Returns false until the audio callback made
+    // that copy, and after it was read. Safe to call outside the audio callback, unlike get_stats().
+    bool get_reset_stats(StageStats (&copy)[NumProfileStages])
+    {
+        if(!reset_stats_ready.exchange(false, std::memory_order_acquire)) return false;
+
+        for(int i = 0; i < NumProfileStages; i++) copy[i] = reset_stats[i];
+        return true;
+    }
+
+    // Call at the start of the audio callback
+    void begin_block()
+    {
+        if(reset_requested.exchange(false, std::memory_order_acquire)) {
+            for(int i = 0; i < NumProfileStages; i++) reset_stats[i] = stats[i];
+            reset_stats_ready.store(true, std::memory_order_release);
+            reset();
+        }
+
+        block_start = last_lap = get_ticks();
+        lap_span_ticks = block_span_ticks = 0;
+    }
+
+    // Adds the time since the previous lap (or the block start) to a stage, minus the spans in between
+    void lap(ProfileStage stage)
+    {
+        uint32_t now = get_ticks();
+        add(stage, now - last_lap - lap_span_ticks);
+        last_lap = now;
+        lap_span_ticks = 0;
+    }
+
+    void begin_span()
+    {
+        span_start = get_ticks();
+    }
+
+    void end_span()
+    {
+        uint32_t ticks = get_ticks() - span_start;
+        lap_span_ticks += ticks;
+        block_span_ticks += ticks;
+    }
+
+    // Adds the spans of this block to a stage, call once per block after the lap they happened in
+    void lap_spans(ProfileStage stage)
+    {
+        add(stage, block_span_ticks);
+        block_span_ticks = 0;
+    }
+
+    // Call at the end of the audio callback
+    void end_block()
+    {
+        add(StageTotal, get_ticks() - block_start);
+    }
+
+    const StageStats& get_stats(ProfileStage stage) const { return stats[stage]; }
+
+    // Converts a tick count to a fraction of the time available for one block
+    float get_load(float ticks) const { return ticks / ticks_per_block; }
+
+    float get_microseconds(float ticks) const { return ticks * 1000000.0f / get_tick_frequency(); }
+
+private:
+    void add(ProfileStage stage, uint32_t ticks)
+    {
+        auto& s = stats[stage];
+        if(ticks < s.min) s.min = ticks;
+        if(ticks > s.max) s.max = ticks;
+        s.total += ticks;
+        s.count++;
+    }
+
+    // Differences between two readings stay correct when the counter wraps
+    static uint32_t get_ticks()
+    {
+#ifdef RECIPHER_HOST
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+#else
+        return System::GetTick();
+#endif
+    }
+
+    static float get_tick_frequency()
+    {
+#ifdef RECIPHER_HOST
+        return 1000000000.0f;
+#else
+        return static_cast<float>(System::GetTickFreq());
+#endif
+    }
+
+    StageStats stats[NumProfileStages];
+    StageStats reset_stats[NumProfileStages];
+
+    float ticks_per_block = 1.0f;
+    uint32_t block_start = 0;
+    uint32_t last_lap = 0;
+    uint32_t span_start = 0;
+    uint32_t lap_span_ticks = 0;
+    uint32_t block_span_ticks = 0;
+
+    std::atomic<bool> reset_requested{false};
+    std::atomic<bool> reset_stats_ready{false};
+};
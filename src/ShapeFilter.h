@@ -3,6 +3,8 @@
 #include <tuple>
 #include <algorithm>
 
+#include "Denormals.h"
+
 
 enum Shape
 {
@@ -23,10 +25,70 @@ constexpr Type map(Type value0To1, Type targetRangeMin, Type targetRangeMax) {
     return targetRangeMin + value0To1 * (targetRangeMax - targetRangeMin);
 }
 
-using FilterState = std::pair<float, float>;
+template <typename FloatType>
+static FloatType fast_tan (FloatType x) noexcept
+{
+    auto x2 = x * x;
+    auto numerator = x * (-135135 + x2 * (17325 + x2 * (-378 + x2)));
+    auto denominator = -135135 + x2 * (62370 + x2 * (-3150 + 28 * x2));
+    return numerator / denominator;
+}
+
+// Resonator g coefficient, tan(pi * f / sample_rate), as a function of fractional MIDI pitch.
+// Built once, so coefficient updates don't need a powf and a tan per band.
+struct ResonatorTuning
+{
+    static constexpr float min_pitch = -36.0f;
+    static constexpr float max_pitch = 132.0f; // Just above nyquist at 32 kHz
+    static constexpr int steps_per_semitone = 8;
+    static constexpr int table_size = static_cast<int>(max_pitch - min_pitch) * steps_per_semitone + 1;
+    
+    ResonatorTuning() {
+        for(int i = 0; i < table_size; i++) {
+            float frequency = std::min(mtof(min_pitch + i / static_cast<float>(steps_per_semitone)), sample_rate * 0.499f);
+            g_table[i] = fast_tan(M_PI * frequency / sample_rate);
+        }
+    }
+    
+    static const ResonatorTuning& get() {
+        static const ResonatorTuning tuning;
+        return tuning;
+    }
+    
+    // Linear interpolation between 1/8th semitone steps, pitches outside the table are clamped
+    float get_g(float pitch) const {
+        float position = std::clamp((pitch - min_pitch) * steps_per_semitone, 0.0f, static_cast<float>(table_size - 1));
+        int idx = std::min(static_cast<int>(position), table_size - 2);
+        float fraction = position - idx;
+        
+        return g_table[idx] + fraction * (g_table[idx + 1] - g_table[idx]);
+    }
+    
+private:
+    float g_table[table_size];
+};
 
+// Pitch above which a band would sit past nyquist
+static const float nyquist_pitch = 69.0f + 12.0f * log2f(sample_rate / 2.0f / 440.0f);
+
+// Harmonics are padded to a multiple of the vector width, padding lanes stay silent
+constexpr int resonator_simd_width = 4;
+
+constexpr int resonator_lanes(int harmonics) {
+    return ((harmonics + resonator_simd_width - 1) / resonator_simd_width) * resonator_simd_width;
+}
+
+// Besides the harmonics, each filter has one band an octave above or below the fundamental, for the octaver.
+// It sits in the lane after the harmonics, which is often a padding lane that gets processed anyway. When the
+// harmonics fill their lanes (4, 8, 12 or 16 of them) it takes another group, the octaver knob needs it either way.
+template <int num_harmonics, int cascade>
 struct ShapeFilter
 {
+    static constexpr int simd_alignment = resonator_simd_width * sizeof(float);
+    static constexpr int octave_lane = num_harmonics;
+    static constexpr int num_lanes = resonator_lanes(num_harmonics + 1);
+    
+    static_assert(num_harmonics > 0 && cascade > 0, "ShapeFilter needs at least one harmonic and one cascade stage");
     
     ShapeFilter() {
         // Initialise harmonics for each shape
@@ -46,26 +108,21 @@ struct ShapeFilter
         
         clear_filters();
         update_filter();
+        apply_targets();
     }
     
     void clear_filters() {
         
-        for(int i = 0; i < num_harmonics; i++) {
-            auto& [s1, s2] = svf[0][i];
-            
-            s1 = 0.0f;
-            s2 = 0.0f;
-            
-            // Apply to cascaded filter
-            for(int c = 0; c < cascade; c++) {
-                svf[c][i] = svf[0][i];
+        for(int c = 0; c < cascade; c++) {
+            for(int i = 0; i < num_lanes; i++) {
+                s1[c][i] = 0.0f;
+                s2[c][i] = 0.0f;
             }
-            
         }
     }
     
     void set_pitch(float midi_note) {
-        note = midi_note;
+        set_coefficient_input(note, midi_note);
     }
     
     void set_shape(float shp) {
@@ -73,74 +130,123 @@ struct ShapeFilter
     }
     
     void set_stretch(float stretch_amt) {
-        stretch = stretch_amt;
+        set_coefficient_input(stretch, stretch_amt);
     }
     
     void set_stretch_mod(float mod) {
-        stretch_mod = mod;
+        set_coefficient_input(stretch_mod, mod);
     }
     
     void set_q(float new_q) {
-        q = std::clamp(new_q, 0.1f, 30.0f);
+        set_coefficient_input(q, std::clamp(new_q, 0.1f, 30.0f));
+    }
+    
+    // Scales the Q of this filter only, for per note expression
+    void set_q_mod(float factor) {
+        set_coefficient_input(q_mod, factor);
     }
     
     void set_bend(float bend_amt) {
-        pitch_bend = bend_amt;
+        set_coefficient_input(pitch_bend, bend_amt);
+    }
+    
+    // Level of the octave band, relative to the fundamental. Positive levels put it an octave up,
+    // negative ones an octave down. At zero the band is kept at rest.
+    void set_octave(float level) {
+        set_coefficient_input(octave_offset, level > 0.0f ? 12.0f : -12.0f);
         
+        // Switching the band on or off needs new coefficients, a level change only changes its amplitude
+        if((level == 0.0f) != (octave_level == 0.0f)) dirty = true;
+        octave_level = std::abs(level);
     }
     
+    // True when pitch, bend, stretch, Q or the octave changed since the last update_filter()
+    bool needs_update() const {
+        return dirty;
+    }
     
-    template <typename FloatType>
-    static FloatType fast_tan (FloatType x) noexcept
-    {
-        auto x2 = x * x;
-        auto numerator = x * (-135135 + x2 * (17325 + x2 * (-378 + x2)));
-        auto denominator = -135135 + x2 * (62370 + x2 * (-3150 + 28 * x2));
-        return numerator / denominator;
+    // When enabled, process_block moves the coefficients linearly from their old to their new
+    // values over the block after update_filter(), instead of stepping at the block boundary
+    void set_coefficient_ramping(bool enabled) {
+        ramp_coefficients = enabled;
     }
     
+    // Call after set_pitch on a new note: the pending update takes effect immediately, so the note doesn't glide in from the old pitch
+    void skip_next_ramp() {
+        skip_ramp = dirty;
+    }
+    
+    // Computes the coefficients for the current settings. They become the ramp targets for the next block.
     void update_filter() {
         
-        R2 = 1.0f / q;
-        gain = R2;
+        dirty = false;
+        
+        R2 = 1.0f / std::clamp(q * q_mod, 0.1f, 30.0f);
+        gain_target = R2;
+        
+        float total_stretch = std::clamp(stretch + stretch_mod, 0.1f, 2.0f);
+        
+        // The harmonic ratios only need a log when the stretch moves
+        if(total_stretch != harmonic_stretch) {
+            harmonic_stretch = total_stretch;
+            
+            for(int i = 0; i < num_harmonics; i++) {
+                harmonic_offset[i] = 12.0f * log2f(i * total_stretch + 1.0f);
+            }
+        }
+        
+        harmonic_offset[octave_lane] = octave_offset;
+        
+        auto& tuning = ResonatorTuning::get();
+        float fundamental = note + pitch_bend;
         
         // Update filters
-        for(int i = 0; i < num_harmonics; i++) {
-            float total_stretch = std::clamp(stretch + stretch_mod, 0.1f, 2.0f);
-            float stretch_factor = i * total_stretch;
+        for(int i = 0; i < num_lanes; i++) {
+            float pitch = fundamental + harmonic_offset[i];
             
-            float frequency = mtof(note + pitch_bend) * (stretch_factor + 1.0f);
+            // Padding lanes, a silent octave band and bands above nyquist are muted and kept at rest
+            bool used = i < num_harmonics || (i == octave_lane && octave_level > 0.0f);
             
-            if(frequency > (sample_rate / 2.0f)) break;
+            if(!used || pitch > nyquist_pitch) {
+                disable_band(i);
+                continue;
+            }
             
-            g[i] = fast_tan(M_PI * frequency / sample_rate);
-            h[i] = 1.0f / (1.0f + R2 * g[i] + g[i] * g[i]);
+            band_enabled[i] = 1.0f;
+            g_target[i] = tuning.get_g(pitch);
+            h_target[i] = 1.0f / (1.0f + R2 * g_target[i] + g_target[i] * g_target[i]);
+            gr_target[i] = g_target[i] + R2;
+        }
+        
+        if(!ramp_coefficients || skip_ramp) {
+            apply_targets();
+            skip_ramp = false;
+        }
+        else {
+            ramp_pending = true;
         }
     }
     
+    // Per-sample path, coefficient changes take effect immediately. It's the scalar reference that
+    // recipher_bench checks process_block against. Call reset_unstable_bands() once per block when using this.
     float process(float input) {
         
+        if(ramp_pending) apply_targets();
+        
+        float amplitude[num_lanes];
+        get_amplitudes(amplitude);
+        
         float output = 0.0f;
-        // Calculate shape position
-        float total_shape = std::clamp(shape, 0.0f, 2.9f);
-        int low_shape = total_shape;
-        int high_shape = low_shape + 1;
-        float distance = total_shape - low_shape;
         
-        for(int hr = 0; hr < num_harmonics; hr++) {
-            // Calculate volume of current harmonic
-            float current_harmonic = map(distance, shape_harmonics[low_shape][hr], shape_harmonics[high_shape][hr]);
+        for(int hr = 0; hr < num_lanes; hr++) {
+            float current_harmonic = amplitude[hr];
             
             if(current_harmonic) {
                 // Apply cascaded filters
                 float filtered = input;
                 
                 for(int c = 0; c < cascade; c++) {
-                    filtered = apply_filter(filtered, c, hr);
-                    
-                    if(!std::isfinite(filtered)) {
-                        filtered = input;
-                    }
+                    filtered = apply_filter(filtered + denormal_offset, c, hr);
                 }
                 
                 output += filtered * current_harmonic;
@@ -150,6 +256,50 @@ struct ShapeFilter
         return output;
     }
     
+    // Processes a whole block, running all harmonic bands side by side so the inner loops
+    // have a fixed trip count and contiguous state that the compiler can map onto vector lanes.
+    void process_block(const float* input, float* output, size_t size) {
+        
+        alignas(simd_alignment) float amplitude[num_lanes];
+        get_amplitudes(amplitude);
+        
+        if(ramp_pending && size > 0) {
+            process_lanes<true>(input, output, size, amplitude);
+            
+            // Land exactly on the targets, so rounding in the steps doesn't accumulate
+            apply_targets();
+        }
+        else {
+            process_lanes<false>(input, output, size, amplitude);
+        }
+        
+        // Don't pass a blown up block on to the rest of the chain
+        if(reset_unstable_bands()) {
+            for(size_t n = 0; n < size; n++) output[n] = 0.0f;
+        }
+    }
+    
+    // Clears the state of bands that blew up, once per block instead of checking every sample.
+    // Returns true if any band had to be reset.
+    bool reset_unstable_bands() {
+        bool unstable = false;
+        
+        for(int i = 0; i < num_lanes; i++) {
+            float energy = 0.0f;
+            for(int c = 0; c < cascade; c++) energy += s1[c][i] + s2[c][i];
+            
+            if(!std::isfinite(energy)) {
+                for(int c = 0; c < cascade; c++) {
+                    s1[c][i] = 0.0f;
+                    s2[c][i] = 0.0f;
+                }
+                unstable = true;
+            }
+        }
+        
+        return unstable;
+    }
+    
     float apply_filter(float input, int c, int hr) {
         /*
          An IIR filter band-pass filter with 12 dB of attenuation per octave, using a TPT structure, designed
@@ -158,37 +308,162 @@ struct ShapeFilter
          state variable filter circuit.
          */
         
-        auto& [s1, s2] = svf[c][hr];
+        auto yHP = h[hr] * (input - s1[c][hr] * gr[hr] - s2[c][hr]);
+        auto yBP = yHP * g[hr] + s1[c][hr];
         
-        auto yHP = h[hr] * (input - s1 * (g[hr] + R2) - s2);
-        auto yBP = yHP * g[hr] + s1;
-        
-        s1      = yHP * g[hr] + yBP;
-        s2      = yBP * g[hr] + (yBP * g[hr] + s2);
+        s1[c][hr] = yHP * g[hr] + yBP;
+        s2[c][hr] = yBP * g[hr] + (yBP * g[hr] + s2[c][hr]);
         
         return yBP * gain;
     }
 
 private:
     
-    static constexpr int num_harmonics = 7;
-    static constexpr int cascade = 3;
+    template <bool ramp>
+    void process_lanes(const float* input, float* output, size_t size, const float* amplitude) {
+        
+        alignas(simd_alignment) float g_step[num_lanes];
+        alignas(simd_alignment) float h_step[num_lanes];
+        alignas(simd_alignment) float gr_step[num_lanes];
+        float gain_step = 0.0f;
+        
+        if(ramp) {
+            float scale = 1.0f / size;
+            
+            for(int i = 0; i < num_lanes; i++) {
+                g_step[i] = (g_target[i] - g[i]) * scale;
+                h_step[i] = (h_target[i] - h[i]) * scale;
+                gr_step[i] = (gr_target[i] - gr[i]) * scale;
+            }
+            
+            gain_step = (gain_target - gain) * scale;
+        }
+        
+        for(size_t n = 0; n < size; n++) {
+            
+            if(ramp) {
+                for(int i = 0; i < num_lanes; i++) {
+                    g[i] += g_step[i];
+                    h[i] += h_step[i];
+                    gr[i] += gr_step[i];
+                }
+                
+                gain += gain_step;
+            }
+            
+            alignas(simd_alignment) float filtered[num_lanes];
+            
+            for(int i = 0; i < num_lanes; i++) filtered[i] = input[n];
+            
+            // Apply cascaded filters
+            for(int c = 0; c < cascade; c++) {
+                for(int i = 0; i < num_lanes; i++) {
+                    // Every stage needs the offset, the band-pass removes it again
+                    if(!has_flush_to_zero) filtered[i] += denormal_offset;
+                    
+                    float yHP = h[i] * (filtered[i] - s1[c][i] * gr[i] - s2[c][i]);
+                    float yBP = yHP * g[i] + s1[c][i];
+                    
+                    s1[c][i] = yHP * g[i] + yBP;
+                    s2[c][i] = yBP * g[i] + (yBP * g[i] + s2[c][i]);
+                    
+                    filtered[i] = yBP * gain;
+                }
+            }
+            
+            float sum = 0.0f;
+            for(int i = 0; i < num_lanes; i++) sum += filtered[i] * amplitude[i];
+            
+            output[n] = sum;
+        }
+    }
+    
+    void apply_targets() {
+        for(int i = 0; i < num_lanes; i++) {
+            g[i] = g_target[i];
+            h[i] = h_target[i];
+            gr[i] = gr_target[i];
+        }
+        
+        gain = gain_target;
+        ramp_pending = false;
+    }
+    
+    void set_coefficient_input(float& target, float value) {
+        if(value != target) {
+            target = value;
+            dirty = true;
+        }
+    }
+    
+    // Disabled bands snap to rest straight away, they are muted anyway
+    void disable_band(int i) {
+        band_enabled[i] = 0.0f;
+        g[i] = g_target[i] = 0.0f;
+        h[i] = h_target[i] = 1.0f;
+        gr[i] = gr_target[i] = R2;
+        
+        for(int c = 0; c < cascade; c++) {
+            s1[c][i] = 0.0f;
+            s2[c][i] = 0.0f;
+        }
+    }
+    
+    // Volume of each harmonic for the current shape position. The octave band follows the fundamental.
+    void get_amplitudes(float* amplitude) {
+        float total_shape = std::clamp(shape, 0.0f, 2.9f);
+        int low_shape = total_shape;
+        int high_shape = low_shape + 1;
+        float distance = total_shape - low_shape;
+        
+        for(int i = 0; i < num_lanes; i++) {
+            amplitude[i] = map(distance, shape_harmonics[low_shape][i], shape_harmonics[high_shape][i]) * band_enabled[i];
+        }
+        
+        amplitude[octave_lane] = map(distance, shape_harmonics[low_shape][0], shape_harmonics[high_shape][0])
+                               * octave_level * band_enabled[octave_lane];
+    }
     
-    float shape_harmonics[(int)Shape::NumShapes][num_harmonics];
+    float shape_harmonics[(int)Shape::NumShapes][num_lanes] = {};
     
     float note = 60.f;
     float q = 2.0f;
+    float q_mod = 1.0f;
     float shape = 0.5f;
     float stretch = 1.0f;
     float stretch_mod = 0.0f;
     
     float pitch_bend = 0.0f;
     
-    FilterState svf[cascade][num_harmonics];
+    float octave_offset = -12.0f;
+    float octave_level = 0.0f;
+    
+    // Distance of each harmonic from the fundamental in semitones, for harmonic_stretch.
+    // Padding lanes stay at zero, update_filter reads them before muting the lane.
+    float harmonic_offset[num_lanes] = {};
+    float harmonic_stretch = -1.0f;
+    
+    bool dirty = true;
+    
+    bool ramp_coefficients = true;
+    bool ramp_pending = false;
+    bool skip_ramp = false;
+    
+    // Filter state and coefficients, stored per band so all harmonics advance together
+    alignas(simd_alignment) float s1[cascade][num_lanes];
+    alignas(simd_alignment) float s2[cascade][num_lanes];
     
     // Filter variables
-    float g[num_harmonics];
-    float h[num_harmonics];
+    alignas(simd_alignment) float g[num_lanes];
+    alignas(simd_alignment) float h[num_lanes];
+    alignas(simd_alignment) float gr[num_lanes];
+    alignas(simd_alignment) float band_enabled[num_lanes];
     float R2;
     float gain;
+    
+    // Coefficients from the last update_filter(), that g, h, gr and gain ramp towards
+    alignas(simd_alignment) float g_target[num_lanes];
+    alignas(simd_alignment) float h_target[num_lanes];
+    alignas(simd_alignment) float gr_target[num_lanes];
+    float gain_target;
 };
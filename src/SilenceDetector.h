@@ -0,0 +1,48 @@
+#pragma once
+
+// Lets a voice or effect stage go to sleep once its input is silent and everything it still held
+// has died away. While asleep the stage is skipped, when it falls asleep its state is cleared so
+// the next sound starts clean.
+
+struct SilenceDetector
+{
+    // About -100 dBFS
+    static constexpr float threshold = 1e-5f;
+
+    static bool is_silent(const float* buffer, size_t size)
+    {
+        float peak = 0.0f;
+        for(size_t i = 0; i < size; i++) peak = std::max(peak, std::abs(buffer[i]));
+        return peak < threshold;
+    }
+
+    // Call before processing a block, returns true while the stage can be skipped.
+    // Any input wakes the stage up again.
+    bool is_asleep(bool input_silent)
+    {
+        if(!input_silent) reset();
+        return asleep;
+    }
+
+    // Call after processing a block. Returns true when the stage has been silent
+    // for hold_samples and just fell asleep, so the caller can clear its state.
+    bool update(bool silent, size_t size, size_t hold_samples)
+    {
+        silent_samples = silent ? silent_samples + size : 0;
+
+        if(asleep || silent_samples < hold_samples) return false;
+
+        asleep = true;
+        return true;
+    }
+
+    void reset()
+    {
+        silent_samples = 0;
+        asleep = false;
+    }
+
+private:
+    size_t silent_samples = 0;
+    bool asleep = false;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+// One-pole smoothing that only has to run once per block. It matches calling fonepole every sample:
+// the value at the end of a block is found in closed form, and inside the block the trajectory is
+// approximated by a straight line between the block's start and end values.
+
+struct BlockSmoother
+{
+    void init(float smoothing_coefficient, float initial_value)
+    {
+        coefficient = smoothing_coefficient;
+        decay_size = 0;
+        snap(initial_value);
+    }
+
+    // Moves a block of size samples towards target, returns the value at the end of the block
+    float process(float target, size_t size)
+    {
+        if(size != decay_size) {
+            block_decay = powf(1.0f - coefficient, static_cast<float>(size));
+            decay_size = size;
+        }
+
+        start = value;
+        value = target + (value - target) * block_decay;
+        return value;
+    }
+
+    // Writes the trajectory of the last processed block, ending at its end value
+    void ramp(float* output, size_t size) const
+    {
+        float step = (value - start) / size;
+        for(size_t i = 0; i < size; i++) output[i] = start + step * (i + 1);
+    }
+
+    // Jumps straight to a value, without smoothing
+    void snap(float new_value)
+    {
+        start = value = new_value;
+    }
+
+    float get_value() const { return value; }
+
+private:
+    float coefficient = 1.0f;
+    float block_decay = 0.0f;
+    size_t decay_size = 0;
+
+    float start = 0.0f;
+    float value = 0.0f;
+};
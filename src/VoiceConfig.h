@@ -0,0 +1,60 @@
+#pragma once
+
+// Polyphony and resonator size are picked at build time, so different variants can trade
+// voices against spectral richness. Override these from the Makefile, for example:
+// make VOICES=12 HARMONICS=5
+
+#ifndef RECIPHER_VOICES
+#define RECIPHER_VOICES 8
+#endif
+
+#ifndef RECIPHER_HARMONICS
+#define RECIPHER_HARMONICS 7
+#endif
+
+#ifndef RECIPHER_CASCADE
+#define RECIPHER_CASCADE 3
+#endif
+
+// The drive's clipper runs at 1, 2 or 4 times the sample rate, more costs more but aliases less
+#ifndef RECIPHER_DRIVE_OVERSAMPLING
+#define RECIPHER_DRIVE_OVERSAMPLING 2
+#endif
+
+constexpr size_t num_voices = RECIPHER_VOICES;
+constexpr int num_voice_harmonics = RECIPHER_HARMONICS;
+constexpr int num_voice_cascades = RECIPHER_CASCADE;
+constexpr int drive_oversampling = RECIPHER_DRIVE_OVERSAMPLING;
+
+static_assert(drive_oversampling == 1 || drive_oversampling == 2 || drive_oversampling == 4, "The drive oversamples by 1, 2 or 4");
+
+// Rough cycle estimates for the Cortex-M7 running at 480 MHz on the Seed. These are per output
+// sample and only meant to compare configurations, use the profiler for real numbers.
+namespace cost_model
+{
+    constexpr float cpu_frequency = 480000000.0f;
+    constexpr float cycles_per_sample = cpu_frequency / sample_rate;
+    
+    // Keep some of the budget free for MIDI, parameter updates and other interrupts
+    constexpr float max_load = 0.8f;
+    
+    constexpr float filter_stage_cycles = 14.0f;   // One TPT bandpass stage for one band
+    constexpr float band_cycles = 3.0f;            // Broadcasting the input and mixing a band into the output
+    constexpr float voice_cycles = 24.0f;          // Envelope, velocity scaling and summing into the mix
+    constexpr float chain_cycles = 720.0f;         // Noise, freeze, delay, drive level matching and output filter
+    constexpr float drive_cycles = 40.0f;          // Resampling and clipping, per oversampled sample
+    
+    constexpr float resonator_cycles(int harmonics, int cascade)
+    {
+        // Padding lanes are processed too, the octave band takes the lane after the harmonics
+        return resonator_lanes(harmonics + 1) * (cascade * filter_stage_cycles + band_cycles);
+    }
+    
+    constexpr float engine_cycles(int voices, int harmonics, int cascade)
+    {
+        return voices * (resonator_cycles(harmonics, cascade) + voice_cycles) + chain_cycles + drive_oversampling * drive_cycles;
+    }
+}
+
+static_assert(cost_model::engine_cycles(num_voices, num_voice_harmonics, num_voice_cascades) < cost_model::cycles_per_sample * cost_model::max_load,
+              "Voice configuration exceeds the estimated CPU budget, use fewer voices or harmonics");
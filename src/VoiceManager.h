@@ -0,0 +1,679 @@
+#pragma once
+
+#include "SilenceDetector.h"
+
+constexpr size_t max_block_size = static_cast<size_t>(block_size);
+
+// Expression of a single note, from its MPE member channel
+struct VoiceExpression
+{
+    float bend = 0.0f;      // Semitones, on top of the bend of every voice
+    float pressure = 0.0f;  // 0 to 1, raises the Q
+    float timbre = 0.0f;    // CC74 around its centre, -1 to 1, moves the stretch
+};
+
+template <int num_harmonics, int cascade>
+class Voice
+{
+public:
+    Voice() {}
+    ~Voice() {}
+    
+    void init(float samplerate)
+    {
+        active = false;
+        envgate = false;
+        pedal_down = false;
+        
+        env.Init(samplerate);
+        env.SetSustainLevel(0.5f);
+        env.SetTime(ADSR_SEG_ATTACK, 0.25f);
+        env.SetTime(ADSR_SEG_DECAY, 0.005f);
+        env.SetTime(ADSR_SEG_RELEASE, 0.2f);
+        filter.set_q(6.0f);
+        set_expression({});
+    }
+    
+    // Renders this voice over a whole block: envelope, resonator bank and velocity scaling
+    void process_block(const float* input, float* output, size_t size)
+    {
+        float amp[max_block_size];
+        
+        for(size_t i = 0; i < size; i++)
+        {
+            amp[i] = env.Process(envgate);
+        }
+        
+        filter.process_block(input, output, size);
+        
+        float gain = velocity / 127.f;
+        
+        // Ramped like the filter coefficients, so pressure doesn't step the level
+        float expression_gain_step = size > 0 ? (expression_gain - previous_expression_gain) / size : 0.0f;
+        
+        for(size_t i = 0; i < size; i++)
+        {
+            output[i] *= amp[i] * gain * (previous_expression_gain + expression_gain_step * (i + 1));
+        }
+        
+        previous_expression_gain = expression_gain;
+        
+        // The voice is done when its envelope is, or when the envelope stayed inaudible past the attack,
+        // like a held note that decayed to a sustain level of zero. This looks at the envelope and not
+        // the output, so held notes survive gaps in the audio input.
+        bool finished = !env.IsRunning();
+        
+        if(!finished && env.GetCurrentSegment() != ADSR_SEG_ATTACK)
+        {
+            bool silent = size > 0 && amp[size - 1] * gain < SilenceDetector::threshold;
+            finished = silence.update(silent, size, silence_hold);
+        }
+        
+        if(finished)
+        {
+            active = false;
+            filter.clear_filters();
+        }
+    }
+    
+    void note_on(float midi_note, float vel)
+    {
+        note     = midi_note;
+        velocity = vel;
+        filter.set_pitch(note);
+        filter.skip_next_ramp();
+        previous_expression_gain = expression_gain;
+        
+        env.Retrigger(false);
+        silence.reset();
+        
+        active  = true;
+        envgate = true;
+    }
+    
+    void set_bend(float bend_amt) {
+        bend = bend_amt;
+        filter.set_bend(bend + expression.bend);
+    }
+    
+    // Call before note_on for a new note, so the note starts with it
+    void set_expression(const VoiceExpression& values) {
+        expression = values;
+        filter.set_bend(bend + expression.bend);
+        
+        // Up to four times the Q at full pressure. The resonators get quieter as their Q rises, the square
+        // root makes up for it like the q_gain of the voice manager does for the Q knob.
+        float q_mod = 1.0f + 3.0f * expression.pressure;
+        filter.set_q_mod(q_mod);
+        expression_gain = sqrtf(q_mod);
+        
+        filter.set_stretch_mod(expression.timbre * timbre_stretch_range);
+    }
+    
+    
+    void note_off() {
+        envgate = false;
+    }
+    
+    inline bool  is_active() const { return active; }
+    inline float get_note() const { return note; }
+    
+    void set_sustain_level(float sustain) {
+        if(!pedal_down) {
+            env.SetSustainLevel(sustain);
+        }
+        
+        sustain_level = sustain;
+    }
+    
+    void set_sustain_pedal(bool is_down) {
+        
+        if(is_down && !pedal_down) {
+            env.SetSustainLevel(1.0f);
+        }
+        if(!is_down && pedal_down) {
+            env.SetSustainLevel(sustain_level);
+        }
+        
+        pedal_down = is_down;
+    }
+    
+    ShapeFilter<num_harmonics, cascade> filter;
+    Adsr       env;
+    SilenceDetector silence;
+    
+    static constexpr size_t silence_hold = max_block_size * 4;
+    
+    float bend = 0.0f;
+    
+    // Stretch added by the timbre at either end of its range
+    static constexpr float timbre_stretch_range = 0.5f;
+    
+private:
+    
+    VoiceExpression expression;
+    float expression_gain = 1.0f;
+    float previous_expression_gain = 1.0f;
+    
+    float sustain_level;
+    
+    float note, velocity;
+    
+    bool active;
+    bool envgate;
+    
+    
+    
+    bool pedal_down;
+};
+
+// How often the allocator had to cut a note short, for tuning the voice count
+struct VoiceStats
+{
+    uint32_t note_ons;
+    uint32_t retriggers;       // Note on for a note that was still sounding, it restarts on its own voice
+    uint32_t released_stolen;  // A voice in its release was cut short
+    uint32_t held_stolen;      // A held note was cut off, every voice was held
+    uint32_t max_active;
+};
+
+// Voices are allocated without searching: free voices are kept on a stack, and sounding ones on two lists,
+// held notes in the order they started and released ones in the order they were let go. A new note takes
+// a free voice, else the voice that was released first, else the oldest held note that isn't the lowest
+// or highest one held. A bitmap of held notes finds those two.
+// A note is looked up by its pitch and channel, so in MPE mode the same pitch can be held on several member
+// channels, each with its own voice and expression.
+template <size_t max_voices, int num_harmonics, int cascade>
+class VoiceManager
+{
+    static_assert(max_voices > 0 && max_voices < 255, "Voice indices are stored as uint8_t, 255 means none");
+    
+public:
+    VoiceManager() {}
+    ~VoiceManager() {}
+    
+    void init(float samplerate)
+    {
+        for(size_t i = 0; i < max_voices; i++)
+        {
+            voices[i].init(samplerate);
+        }
+        
+        num_active = 0;
+        
+        // Popped from the back, so voice 0 is used first
+        num_free = max_voices;
+        for(size_t i = 0; i < max_voices; i++)
+        {
+            free_voices_stack[i] = static_cast<uint8_t>(max_voices - 1 - i);
+            voice_state[i] = VoiceFree;
+        }
+        
+        held = released = {};
+        
+        for(auto& voice : note_voice) voice = no_voice;
+        for(auto& count : held_count) count = 0;
+        for(auto& bits : held_notes) bits = 0;
+        
+        for(size_t i = 0; i < max_voices; i++)
+        {
+            voice_same_note[i] = no_voice;
+            voice_channel[i] = no_channel;
+            voice_pending[i] = false;
+        }
+        
+        for(int i = 0; i < num_channels; i++)
+        {
+            channel_voice[i] = no_voice;
+            channel_expression[i] = {};
+        }
+        
+        num_pending = 0;
+        update_all = true;
+        
+        reset_stats();
+    }
+    
+    // Renders only the sounding voices, each one across the full block, and sums them
+    void process_block(const float* input, float* output, size_t size)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            output[i] = 0.0f;
+        }
+        
+        size_t idx = 0;
+        while(idx < num_active)
+        {
+            uint8_t voice_index = active_voices[idx];
+            VoiceType& v = voices[voice_index];
+            v.process_block(input, scratch, size);
+            
+            for(size_t i = 0; i < size; i++)
+            {
+                output[i] += scratch[i];
+            }
+            
+            // Remove voices that went idle by moving the last active voice into their slot
+            if(!v.is_active())
+            {
+                active_voices[idx] = active_voices[--num_active];
+                release_voice(voice_index);
+            }
+            else {
+                idx++;
+            }
+        }
+        
+        for(size_t i = 0; i < size; i++)
+        {
+            output[i] *= q_gain;
+        }
+    }
+    
+    // Channels count from 0. Notes on a channel take its expression, no_channel for notes without any.
+    void note_on(float notenumber, float velocity, int channel = no_channel)
+    {
+        stats.note_ons++;
+        
+        uint8_t voice_index = find_voice(note_key(notenumber), channel);
+        
+        if(voice_index != no_voice)
+        {
+            // Still sounding, restart it as the newest held note
+            stats.retriggers++;
+            if(voice_state[voice_index] == VoiceHeld) set_held_note(note_key(notenumber), false);
+            unlink(voice_index);
+        }
+        else
+        {
+            voice_index = allocate();
+            unlink(voice_index);
+            
+            if(voice_state[voice_index] == VoiceFree)
+            {
+                active_voices[num_active++] = voice_index;
+                stats.max_active = std::max(stats.max_active, static_cast<uint32_t>(num_active));
+            }
+            else
+            {
+                // Stolen, the voice stops sounding its old note
+                int old_note = note_key(voices[voice_index].get_note());
+                if(voice_state[voice_index] == VoiceHeld) set_held_note(old_note, false);
+                remove_note_voice(old_note, voice_index);
+            }
+            
+            add_note_voice(note_key(notenumber), voice_index);
+        }
+        
+        push_back(held, voice_index);
+        voice_state[voice_index] = VoiceHeld;
+        set_held_note(note_key(notenumber), true);
+        
+        voice_channel[voice_index] = static_cast<int8_t>(channel);
+        if(channel != no_channel) channel_voice[channel] = voice_index;
+        
+        voices[voice_index].set_expression(channel != no_channel ? channel_expression[channel] : VoiceExpression{});
+        voices[voice_index].note_on(notenumber, velocity);
+        mark_pending(voice_index);
+    }
+    
+    // Releases the note played on the same channel
+    void note_off(float notenumber, [[maybe_unused]] float velocity, int channel = no_channel)
+    {
+        uint8_t voice_index = find_voice(note_key(notenumber), channel);
+        
+        if(voice_index != no_voice && voice_state[voice_index] == VoiceHeld)
+        {
+            release_note(voice_index);
+        }
+    }
+    
+    void free_voices()
+    {
+        while(held.head != no_voice)
+        {
+            release_note(held.head);
+        }
+    }
+    
+    // Expression on a channel moves the last note played on it, and is where the next note on it starts
+    void set_channel_bend(int channel, float semitones)
+    {
+        channel_expression[channel].bend = semitones;
+        apply_expression(channel);
+    }
+    
+    void set_channel_pressure(int channel, float pressure)
+    {
+        channel_expression[channel].pressure = pressure;
+        apply_expression(channel);
+    }
+    
+    void set_channel_timbre(int channel, float timbre)
+    {
+        channel_expression[channel].timbre = timbre;
+        apply_expression(channel);
+    }
+    
+    // Clears the expression of every channel and note, for when the MPE zone changes
+    void reset_expression()
+    {
+        for(auto& expression : channel_expression) expression = {};
+        
+        for(size_t i = 0; i < max_voices; i++)
+        {
+            voice_channel[i] = no_channel;
+            voices[i].set_expression({});
+        }
+        
+        update_all = true;
+    }
+    
+    // Whether a voice is sounding the note, held or in its release
+    bool is_sounding(float notenumber) const { return note_voice[note_key(notenumber)] != no_voice; }
+    
+    const VoiceStats& get_stats() const { return stats; }
+    
+    void reset_stats()
+    {
+        stats = {};
+        stats.max_active = num_active;
+    }
+    
+    void set_stretch(float all_val) {
+        for(auto& voice : voices) voice.filter.set_stretch(all_val);
+        update_all = true;
+    }
+    
+    void set_shape(float all_val) {
+        for(auto& voice : voices) voice.filter.set_shape(all_val);
+    }
+    
+    void set_q(float all_val) {
+        for(auto& voice : voices) voice.filter.set_q(all_val);
+        update_all = true;
+        q_gain = sqrt(all_val);
+    }
+    
+    void set_attack(float all_val) {
+        for(auto& voice : voices) voice.env.SetTime(ADSR_SEG_ATTACK, all_val / 1000.0f);
+    }
+    
+    void set_decay(float all_val) {
+        for(auto& voice : voices) voice.env.SetTime(ADSR_SEG_DECAY, all_val / 1000.0f);
+    }
+    
+    void set_sustain(float all_val) {
+        for(auto& voice : voices) voice.set_sustain_level(all_val);
+    }
+    
+    void set_release(float all_val) {
+        for(auto& voice : voices) voice.env.SetTime(ADSR_SEG_RELEASE, all_val / 1000.0f);
+    }
+    
+    void set_bend(float pitch_bend) {
+        for(auto& voice : voices) voice.set_bend(pitch_bend);
+        update_all = true;
+    }
+    
+    // Octave band of every voice, positive levels are an octave up and negative ones an octave down
+    void set_octave(float level) {
+        for(auto& voice : voices) voice.filter.set_octave(level);
+        update_all = true;
+    }
+    
+    // Rebuilds coefficients only for sounding voices whose pitch, bend, stretch, Q or octave changed.
+    // After a note or the expression of a single note changed, only the voices it touched are looked at.
+    // Idle voices keep their flag until note_on makes them active again.
+    void update_filters() {
+        if(update_all)
+        {
+            for(size_t idx = 0; idx < num_active; idx++)
+            {
+                auto& filter = voices[active_voices[idx]].filter;
+                if(filter.needs_update()) filter.update_filter();
+            }
+        }
+        else
+        {
+            for(size_t idx = 0; idx < num_pending; idx++)
+            {
+                auto& voice = voices[pending_voices[idx]];
+                if(voice.is_active() && voice.filter.needs_update()) voice.filter.update_filter();
+            }
+        }
+        
+        for(size_t idx = 0; idx < num_pending; idx++) voice_pending[pending_voices[idx]] = false;
+        num_pending = 0;
+        update_all = false;
+    }
+    
+    void set_sustain_pedal(bool pedal_down) {
+        for(auto& voice : voices) voice.set_sustain_pedal(pedal_down);
+    }
+    
+    static constexpr int no_channel = -1;
+    
+private:
+    using VoiceType = Voice<num_harmonics, cascade>;
+    
+    static constexpr uint8_t no_voice = 255;
+    static constexpr int num_channels = 16;
+    static constexpr int num_notes = 128;
+    
+    enum VoiceState : uint8_t
+    {
+        VoiceFree,
+        VoiceHeld,
+        VoiceReleased
+    };
+    
+    // Doubly linked through voice_prev and voice_next, a voice is on one list at most
+    struct VoiceList
+    {
+        uint8_t head = no_voice;
+        uint8_t tail = no_voice;
+    };
+    
+    VoiceType voices[max_voices];
+    
+    // Indices of the voices that are currently sounding, packed at the front
+    uint8_t active_voices[max_voices];
+    size_t  num_active = 0;
+    
+    uint8_t free_voices_stack[max_voices];
+    size_t  num_free = 0;
+    
+    VoiceState voice_state[max_voices];
+    uint8_t voice_prev[max_voices];
+    uint8_t voice_next[max_voices];
+    
+    VoiceList held;     // Oldest note on first
+    VoiceList released; // Oldest note off first
+    
+    // The voices sounding each note, held or released, chained through voice_same_note.
+    // There's more than one only when the note is played on several channels.
+    uint8_t note_voice[num_notes];
+    uint8_t voice_same_note[max_voices];
+    
+    // Voices holding each note, and one bit per held note for the lowest and highest one
+    uint8_t  held_count[num_notes];
+    uint32_t held_notes[num_notes / 32];
+    
+    // The channel each voice's note came in on, and the last voice started on each channel
+    int8_t  voice_channel[max_voices];
+    uint8_t channel_voice[num_channels];
+    VoiceExpression channel_expression[num_channels];
+    
+    // Voices that may need new coefficients, unless all of them may
+    uint8_t pending_voices[max_voices];
+    bool    voice_pending[max_voices];
+    size_t  num_pending = 0;
+    bool    update_all = true;
+    
+    VoiceStats stats = {};
+    
+    float scratch[max_block_size];
+    
+    static int note_key(float note)
+    {
+        return std::clamp(static_cast<int>(note), 0, num_notes - 1);
+    }
+    
+    // The voice sounding the note that was played on the channel
+    uint8_t find_voice(int note, int channel) const
+    {
+        for(uint8_t voice_index = note_voice[note]; voice_index != no_voice; voice_index = voice_same_note[voice_index])
+        {
+            if(voice_channel[voice_index] == channel) return voice_index;
+        }
+        return no_voice;
+    }
+    
+    void add_note_voice(int note, uint8_t voice_index)
+    {
+        voice_same_note[voice_index] = note_voice[note];
+        note_voice[note] = voice_index;
+    }
+    
+    void remove_note_voice(int note, uint8_t voice_index)
+    {
+        uint8_t* link = &note_voice[note];
+        while(*link != no_voice && *link != voice_index) link = &voice_same_note[*link];
+        
+        if(*link == voice_index) *link = voice_same_note[voice_index];
+    }
+    
+    void release_note(uint8_t voice_index)
+    {
+        voices[voice_index].note_off();
+        
+        unlink(voice_index);
+        push_back(released, voice_index);
+        voice_state[voice_index] = VoiceReleased;
+        set_held_note(note_key(voices[voice_index].get_note()), false);
+    }
+    
+    // Picks the voice for a new note. The voice may still be on the held or released list.
+    uint8_t allocate()
+    {
+        if(num_free > 0)
+        {
+            return free_voices_stack[--num_free];
+        }
+        
+        if(released.head != no_voice)
+        {
+            stats.released_stolen++;
+            return released.head;
+        }
+        
+        stats.held_stolen++;
+        
+        // The oldest held note, unless it's the lowest or the highest one. Those are at most two voices,
+        // so this looks at three at most.
+        int lowest = lowest_held_note();
+        int highest = highest_held_note();
+        
+        for(uint8_t voice_index = held.head; voice_index != no_voice; voice_index = voice_next[voice_index])
+        {
+            int note = note_key(voices[voice_index].get_note());
+            if(note != lowest && note != highest) return voice_index;
+        }
+        
+        // Only the lowest and highest notes are held
+        return held.head;
+    }
+    
+    void apply_expression(int channel)
+    {
+        uint8_t voice_index = channel_voice[channel];
+        
+        if(voice_index != no_voice && voice_channel[voice_index] == channel && voice_state[voice_index] != VoiceFree)
+        {
+            voices[voice_index].set_expression(channel_expression[channel]);
+            mark_pending(voice_index);
+        }
+    }
+    
+    void mark_pending(uint8_t voice_index)
+    {
+        if(voice_pending[voice_index]) return;
+        
+        voice_pending[voice_index] = true;
+        pending_voices[num_pending++] = voice_index;
+    }
+    
+    // A voice that went idle goes back on the free stack
+    void release_voice(uint8_t voice_index)
+    {
+        if(voice_state[voice_index] == VoiceHeld)
+        {
+            set_held_note(note_key(voices[voice_index].get_note()), false);
+        }
+        
+        unlink(voice_index);
+        remove_note_voice(note_key(voices[voice_index].get_note()), voice_index);
+        
+        voice_state[voice_index] = VoiceFree;
+        free_voices_stack[num_free++] = voice_index;
+    }
+    
+    void push_back(VoiceList& list, uint8_t voice_index)
+    {
+        voice_prev[voice_index] = list.tail;
+        voice_next[voice_index] = no_voice;
+        
+        if(list.tail != no_voice) voice_next[list.tail] = voice_index;
+        else list.head = voice_index;
+        
+        list.tail = voice_index;
+    }
+    
+    // Takes a voice off the list it is on, if any
+    void unlink(uint8_t voice_index)
+    {
+        if(voice_state[voice_index] == VoiceFree) return;
+        
+        VoiceList& list = voice_state[voice_index] == VoiceHeld ? held : released;
+        uint8_t prev = voice_prev[voice_index];
+        uint8_t next = voice_next[voice_index];
+        
+        if(prev != no_voice) voice_next[prev] = next;
+        else list.head = next;
+        
+        if(next != no_voice) voice_prev[next] = prev;
+        else list.tail = prev;
+    }
+    
+    void set_held_note(int note, bool is_held)
+    {
+        held_count[note] += is_held ? 1 : -1;
+        
+        uint32_t bit = 1u << (note & 31);
+        
+        if(held_count[note]) held_notes[note >> 5] |= bit;
+        else held_notes[note >> 5] &= ~bit;
+    }
+    
+    int lowest_held_note() const
+    {
+        for(int word = 0; word < num_notes / 32; word++)
+        {
+            if(held_notes[word]) return word * 32 + __builtin_ctz(held_notes[word]);
+        }
+        return -1;
+    }
+    
+    int highest_held_note() const
+    {
+        for(int word = num_notes / 32 - 1; word >= 0; word--)
+        {
+            if(held_notes[word]) return word * 32 + 31 - __builtin_clz(held_notes[word]);
+        }
+        return -1;
+    }
+    
+    float q_gain = 1.0f;
+};